@@ -36,6 +36,19 @@
 #define	CH_USB_HID_EP_IN			(CH_USB_HID_EP | 0x80)
 #define	CH_USB_HID_EP_OUT			(CH_USB_HID_EP | 0x00)
 #define	CH_USB_HID_EP_SIZE			64
+#define	CH_USB_HID_STREAM_INTERFACE		0x0002
+#define	CH_USB_HID_STREAM_EP			0x0002
+#define	CH_USB_HID_STREAM_EP_IN			(CH_USB_HID_STREAM_EP | 0x80)
+#define	CH_USB_HID_STREAM_EP_SIZE		16
+#define	CH_USB_BULK_INTERFACE			0x0001
+#define	CH_USB_BULK_EP				0x0003
+#define	CH_USB_BULK_EP_IN			(CH_USB_BULK_EP | 0x80)
+#define	CH_USB_BULK_EP_OUT			(CH_USB_BULK_EP | 0x00)
+#define	CH_USB_BULK_EP_SIZE			64
+
+/* frame numbers are 11 bits */
+#define	CH_USB_FRAME_MASK			0x07ff
+#define	CH_USB_FRAME_HALF			0x0400
 
 /* ensure this is incremented on each released build */
 #define CH_VERSION_MAJOR			3
@@ -69,7 +82,7 @@
 /**
  * CH_CMD_GET_MULTIPLIER:
  *
- * Gets the multiplier value.
+ * Gets the multiplier value, which is 0 when the sensor is powered down.
  *
  * IN:  [1:cmd]
  * OUT: [1:retval][1:cmd][1:multiplier_value]
@@ -81,7 +94,12 @@
 /**
  * CH_CMD_SET_MULTIPLIER:
  *
- * Sets the multiplier value.
+ * Sets the multiplier value, which powers the sensor up. Readings power
+ * the sensor up at the last multiplier that was set, or 100% if none has
+ * been, so setting 0 only powers it down until the next reading.
+ *
+ * The sensor is powered down again after the time set with
+ * CH_CMD_SET_POWER_TIMEOUT, or when the bus is suspended.
  *
  * IN:  [1:cmd][1:multiplier_value]
  * OUT: [1:retval][1:cmd]
@@ -107,6 +125,9 @@
  *
  * Sets the integral time.
  *
+ * While a stream is running CH_ERROR_INVALID_VALUE is returned if a
+ * reading would no longer fit in the stream interval.
+ *
  * IN:  [1:cmd][2:integral_time]
  * OUT: [1:retval][1:cmd]
  *
@@ -154,7 +175,9 @@
  * CH_CMD_SET_LEDS:
  *
  * Set the LED state. Using a @repeat value of anything other than
- * 0 will block the processor for the duration of the command.
+ * 0 flashes the LEDs @repeat times in the background, with @on-time and
+ * @off-time specified in ms. A @repeat value of 0xff flashes the LEDs
+ * until the next CH_CMD_SET_LEDS.
  *
  * If @repeat is not 0, then the LEDs are reset to all off at the end
  * of the sequence.
@@ -171,8 +194,27 @@
  *
  * Take a raw reading.
  *
+ * The USB frame number when the integration started and ended is also
+ * returned, along with the time in us since the SOF of that frame. This
+ * allows readings from several devices on the same host to be aligned.
+ *
+ * @flags has CH_READING_FLAG_BOTH_EDGES set if the count is of both
+ * the rising and falling edges, as set by CH_CMD_SET_EDGE_MODE.
+ *
+ * @corrected is @count less the dark offset for the color and multiplier
+ * if CH_CMD_SET_DARK_SUBTRACT is enabled, when @flags also has
+ * CH_READING_FLAG_DARK_SUBTRACTED set. It is also corrected for the
+ * change in die temperature if CH_CMD_SET_TEMP_COEFFICIENTS has been
+ * used, when @flags has CH_READING_FLAG_TEMP_COMPENSATED set. Otherwise
+ * it is the same as @count.
+ *
+ * @temperature is the die temperature at the end of the reading as for
+ * CH_CMD_GET_TEMPERATURE, or CH_TEMPERATURE_UNKNOWN.
+ *
  * IN:  [1:cmd]
- * OUT: [1:retval][1:cmd][4:count]
+ * OUT: [1:retval][1:cmd][4:count][2:start_frame][2:start_offset]
+ *      [2:end_frame][2:end_offset][1:flags][4:corrected]
+ *      [2:temperature]
  *
  * This command is only available in firmware mode.
  **/
@@ -293,22 +335,482 @@
  * Tests the device by trying to get a non-zero reading from each
  * color channel.
  *
+ * In firmware mode the results are also returned, which takes about
+ * 700ms. @hz is the output frequency of each color in the order of
+ * ChColorSelect, at 20%, 2% and then 100% for each, measured to 10Hz.
+ * @multiplier_cycles and @color_select_cycles are the most instruction
+ * cycles the pins took to read back as set. @crc is the CRC-16/CCITT of
+ * the flash from CH_EEPROM_ADDR_RUNCODE to CH_EEPROM_ADDR_FAULT_LOG,
+ * taking each word low byte first. The multiplier and color select are
+ * left as they were.
+ *
  * IN:  [1:cmd]
- * OUT: [1:retval][1:cmd]
+ * OUT: [1:retval][1:cmd]				(bootloader)
+ * OUT: [1:retval][1:cmd][4:hz]*12[2:multiplier_cycles]
+ *      [2:color_select_cycles][2:crc]			(firmware)
  *
  * This command is available in bootloader and firmware mode.
  **/
 #define	CH_CMD_SELF_TEST			0x40
 
+/**
+ * CH_CMD_SET_STREAM:
+ *
+ * Sets how often to take a raw reading with the current settings and
+ * send it to the host on the stream endpoint, rather than in the reply
+ * to a command. An @interval of 0 stops the stream.
+ *
+ * Each sample is sent as a 16 byte report on endpoint 0x82:
+ *
+ *  [2:sample_number][1:color_select][1:multiplier][4:count]
+ *  [2:start_frame][2:start_offset][2:end_frame][2:end_offset]
+ *
+ * The frame numbers and offsets are the same as CH_CMD_TAKE_READING_RAW,
+ * and the reading flags are sent in the top bits of @multiplier. If the
+ * flags have CH_READING_FLAG_DARK_SUBTRACTED set then @count is the
+ * corrected count.
+ *
+ * The @sample_number is incremented for each sample, including those
+ * that were dropped because the host had not read the previous one.
+ *
+ * If @flags has CH_STREAM_FLAG_BULK set then the samples are sent on
+ * the bulk endpoint 0x83 of the vendor interface instead.
+ *
+ * The main loop is blocked while a reading is taken, so an @interval
+ * that is not longer than a reading at the current integral time is
+ * refused with CH_ERROR_INVALID_VALUE. A reading takes at most
+ * @integral_time * 105 / 12000 ms, rounded up.
+ *
+ * IN:  [1:cmd][2:interval_ms][1:flags]
+ * OUT: [1:retval][1:cmd]
+ *
+ * This command is only available in firmware mode.
+ **/
+#define	CH_CMD_SET_STREAM			0x50
+
+/**
+ * CH_CMD_ARM_READING:
+ *
+ * Arms a raw reading with the current settings to start when the device
+ * sees the SOF for the USB frame @frame. Devices on the same host
+ * controller see the same frame numbers, so they can all be armed with
+ * the same frame to integrate at the same time.
+ *
+ * The frame must be less than 1.024s (0x400 frames) in the future, and
+ * arming again replaces any earlier reading.
+ *
+ * Arming powers the sensor up if it is off, and the warm-up and first
+ * pulse are then waited for between commands. If the output is too slow
+ * for a pulse to be seen before the frame, the reading waits for it
+ * and starts up to one output period late.
+ *
+ * The reading is taken from the main loop, so CH_ERROR_BUSY is returned
+ * while a stream or program is running. Until the reading has been
+ * taken CH_ERROR_BUSY is also returned for CH_CMD_TAKE_READING_RAW,
+ * CH_CMD_TAKE_DARK_CALIBRATION, CH_CMD_SELF_TEST and for starting a
+ * stream or program, as they would delay it past the frame.
+ *
+ * IN:  [1:cmd][2:frame]
+ * OUT: [1:retval][1:cmd]
+ *
+ * This command is only available in firmware mode.
+ **/
+#define	CH_CMD_ARM_READING			0x51
+
+/**
+ * CH_CMD_GET_ARMED_READING:
+ *
+ * Gets the reading taken for CH_CMD_ARM_READING, in the same format as
+ * CH_CMD_TAKE_READING_RAW. If the reading has not finished yet then
+ * CH_ERROR_INCOMPLETE_REQUEST is returned, and if no reading has been
+ * armed then CH_ERROR_NOT_ARMED is returned.
+ *
+ * IN:  [1:cmd]
+ * OUT: [1:retval][1:cmd][4:count][2:start_frame][2:start_offset]
+ *      [2:end_frame][2:end_offset][1:flags][4:corrected]
+ *      [2:temperature]
+ *
+ * This command is only available in firmware mode.
+ **/
+#define	CH_CMD_GET_ARMED_READING		0x52
+
+/**
+ * CH_CMD_PING:
+ *
+ * Echoes @token along with the free-running device clock, which counts
+ * instruction cycles at 12MHz and wraps every 358s. This can be used to
+ * estimate the offset and drift between the host and device clocks.
+ *
+ * @process is the number of cycles spent handling the previous command
+ * on the HID endpoint, which separates firmware time from the USB time
+ * when measuring its round trip.
+ *
+ * IN:  [1:cmd][4:token]
+ * OUT: [1:retval][1:cmd][4:token][4:clock][4:process]
+ *
+ * This command is only available in firmware mode.
+ **/
+#define	CH_CMD_PING				0x53
+
+/**
+ * CH_CMD_GET_STATS:
+ *
+ * Gets the performance counters, which all start at zero on reset and
+ * wrap when they overflow. If @flags has CH_STATS_FLAG_RESET set then
+ * the counters on @page are cleared after being read.
+ *
+ * Page 0 has the general counters:
+ *
+ *  [4:process_io][4:readings][2:incomplete][2:edge_overflows]
+ *  [4:loop_max][2:suspends][2:resumes][2:watchdog_near_misses]
+ *  [2:power_ups][2:sleeps][2:remote_wakeups]
+ *
+ * @loop_max is the longest main loop iteration in instruction cycles,
+ * and @watchdog_near_misses counts iterations taking longer than half
+ * the default watchdog period. @power_ups counts the times the sensor
+ * was powered up, @sleeps the times the device went to sleep while the
+ * bus was suspended, and @remote_wakeups the times it woke the host.
+ *
+ * Page 1 and above have the number of each command that has been
+ * handled, on any interface, as up to 30 entries of [1:cmd][1:count]
+ * per page. These counts stop at 255 rather than wrapping. Commands that
+ * are not known are counted with a @cmd of 0x00 in the last entry, and
+ * CH_ERROR_INVALID_VALUE is returned for pages after that.
+ *
+ * IN:  [1:cmd][1:page][1:flags]
+ * OUT: [1:retval][1:cmd][60:counters]
+ *
+ * This command is only available in firmware mode.
+ **/
+#define	CH_CMD_GET_STATS			0x54
+
+/**
+ * CH_CMD_GET_TRACE:
+ *
+ * Gets the last 8 commands handled on the HID or vendor interface, in
+ * chunks of up to 6 entries with chunk 0 having the oldest. Each entry
+ * is the command, its return code, the device clock when it was started
+ * as returned by CH_CMD_PING, and the number of cycles spent handling it:
+ *
+ *  [1:cmd][1:retval][4:start][4:duration]
+ *
+ * The trace is not cleared by reading it, and this command is recorded
+ * in the trace after its reply has been built.
+ *
+ * IN:  [1:cmd][1:chunk]
+ * OUT: [1:retval][1:cmd][1:entries][60:trace]
+ *
+ * This command is available in bootloader and firmware mode.
+ **/
+#define	CH_CMD_GET_TRACE			0x55
+
+/**
+ * CH_CMD_GET_FAULT_LOG:
+ *
+ * Gets the last fatal error, after which the device resets into the
+ * bootloader rather than the firmware. Each value is 14 bits, and
+ * @error is 0x3fff if no fault has been recorded since the log was
+ * cleared.
+ *
+ * @pcon is the reset flags, @stkptr the stack pointer and @tos the
+ * program address the fatal error was raised from. @count is the number
+ * of faults since the log was cleared, of which only the last is kept.
+ *
+ * IN:  [1:cmd]
+ * OUT: [1:retval][1:cmd][2:error][2:pcon][2:stkptr][2:tos][2:count]
+ *
+ * This command is available in bootloader and firmware mode.
+ **/
+#define	CH_CMD_GET_FAULT_LOG			0x56
+
+/**
+ * CH_CMD_CLEAR_FAULT_LOG:
+ *
+ * Clears the fault log.
+ *
+ * IN:  [1:cmd]
+ * OUT: [1:retval][1:cmd]
+ *
+ * This command is available in bootloader and firmware mode.
+ **/
+#define	CH_CMD_CLEAR_FAULT_LOG			0x57
+
+/**
+ * CH_CMD_GET_EDGE_MODE:
+ *
+ * Gets which edges of the sensor output are counted.
+ *
+ * IN:  [1:cmd]
+ * OUT: [1:retval][1:cmd][1:edge_mode]
+ *
+ * This command is only available in firmware mode.
+ **/
+#define	CH_CMD_GET_EDGE_MODE			0x58
+
+/**
+ * CH_CMD_SET_EDGE_MODE:
+ *
+ * Sets which edges of the sensor output are counted. Counting both the
+ * rising and falling edges gives twice the count for the same integral
+ * time, so the same precision can be had in half the time in low light.
+ *
+ * IN:  [1:cmd][1:edge_mode]
+ * OUT: [1:retval][1:cmd]
+ *
+ * This command is only available in firmware mode.
+ **/
+#define	CH_CMD_SET_EDGE_MODE			0x59
+
+/**
+ * CH_CMD_TAKE_DARK_CALIBRATION:
+ *
+ * Takes a reading of each color with the current multiplier and integral
+ * time, which must be done with the aperture covered, and stores them
+ * in flash as the dark offsets for that multiplier. The edge mode does
+ * not matter as the offsets are always kept as rising edges.
+ *
+ * Each offset is the dark count scaled to an integral time of 0x40000,
+ * so that it can be subtracted from readings of any integral time. The
+ * offsets are kept in 14 bits, and CH_DARK_OFFSET_NONE means there is
+ * no offset for that color and multiplier.
+ *
+ * This can take up to 4 times the integral time.
+ *
+ * IN:  [1:cmd]
+ * OUT: [1:retval][1:cmd][2:red][2:white][2:blue][2:green]
+ *
+ * This command is only available in firmware mode.
+ **/
+#define	CH_CMD_TAKE_DARK_CALIBRATION		0x5a
+
+/**
+ * CH_CMD_GET_DARK_OFFSETS:
+ *
+ * Gets the dark offsets stored for a multiplier, in the same format as
+ * CH_CMD_TAKE_DARK_CALIBRATION.
+ *
+ * IN:  [1:cmd][1:multiplier]
+ * OUT: [1:retval][1:cmd][2:red][2:white][2:blue][2:green]
+ *
+ * This command is only available in firmware mode.
+ **/
+#define	CH_CMD_GET_DARK_OFFSETS			0x5b
+
+/**
+ * CH_CMD_GET_DARK_SUBTRACT:
+ *
+ * Gets if readings are corrected using the dark offsets.
+ *
+ * IN:  [1:cmd]
+ * OUT: [1:retval][1:cmd][1:enabled]
+ *
+ * This command is only available in firmware mode.
+ **/
+#define	CH_CMD_GET_DARK_SUBTRACT		0x5c
+
+/**
+ * CH_CMD_SET_DARK_SUBTRACT:
+ *
+ * Sets if readings are corrected using the dark offsets, so the host
+ * does not have to take its own dark readings.
+ *
+ * IN:  [1:cmd][1:enabled]
+ * OUT: [1:retval][1:cmd]
+ *
+ * This command is only available in firmware mode.
+ **/
+#define	CH_CMD_SET_DARK_SUBTRACT		0x5d
+
+/**
+ * CH_CMD_GET_TEMPERATURE:
+ *
+ * Gets the die temperature in 1/100 degrees C from the temperature
+ * indicator. This is only accurate to a few degrees, but follows changes
+ * well enough to correct readings for them.
+ *
+ * The PIC16F1454 has no ADC to read the temperature indicator, and so
+ * returns CH_ERROR_NOT_IMPLEMENTED.
+ *
+ * IN:  [1:cmd]
+ * OUT: [1:retval][1:cmd][2:temperature]
+ *
+ * This command is only available in firmware mode.
+ **/
+#define	CH_CMD_GET_TEMPERATURE			0x5e
+
+/**
+ * CH_CMD_GET_TEMP_COEFFICIENTS:
+ *
+ * Gets the temperature coefficients of each color, as set by
+ * CH_CMD_SET_TEMP_COEFFICIENTS.
+ *
+ * IN:  [1:cmd]
+ * OUT: [1:retval][1:cmd][2:red][2:white][2:blue][2:green][2:reference]
+ *
+ * This command is only available in firmware mode.
+ **/
+#define	CH_CMD_GET_TEMP_COEFFICIENTS		0x5f
+
+/**
+ * CH_CMD_SET_TEMP_COEFFICIENTS:
+ *
+ * Sets how much each color changes with the die temperature, in parts
+ * per million for each degree C, and the temperature in 1/100 degrees C
+ * the readings are corrected to. These are kept in flash.
+ *
+ * Each value must be between -8191 and 8191, and a @reference of
+ * CH_TEMPERATURE_UNKNOWN turns the correction off.
+ *
+ * The PIC16F1454 cannot read the temperature, and so returns
+ * CH_ERROR_NOT_IMPLEMENTED.
+ *
+ * IN:  [1:cmd][2:red][2:white][2:blue][2:green][2:reference]
+ * OUT: [1:retval][1:cmd]
+ *
+ * This command is only available in firmware mode.
+ **/
+#define	CH_CMD_SET_TEMP_COEFFICIENTS		0x60
+
+/**
+ * CH_CMD_GET_POWER_TIMEOUT:
+ *
+ * Gets the time in ms the sensor is left powered up for after a reading,
+ * as set by CH_CMD_SET_POWER_TIMEOUT.
+ *
+ * IN:  [1:cmd]
+ * OUT: [1:retval][1:cmd][2:timeout]
+ *
+ * This command is only available in firmware mode.
+ **/
+#define	CH_CMD_GET_POWER_TIMEOUT		0x61
+
+/**
+ * CH_CMD_SET_POWER_TIMEOUT:
+ *
+ * Sets the time in ms the sensor is left powered up for after a reading
+ * or CH_CMD_SET_MULTIPLIER, or 0 to leave it powered up until the
+ * multiplier is set to 0. The default is CH_SENSOR_POWER_TIMEOUT_DEFAULT.
+ *
+ * When the sensor has been powered down, the next reading waits 100us for
+ * it to warm up and skips the first pulse, which takes one period of the
+ * output. Hosts taking readings less often than the timeout can avoid this
+ * by setting the multiplier before each one.
+ *
+ * IN:  [1:cmd][2:timeout]
+ * OUT: [1:retval][1:cmd]
+ *
+ * This command is only available in firmware mode.
+ **/
+#define	CH_CMD_SET_POWER_TIMEOUT		0x62
+
+/**
+ * CH_CMD_GET_WAKE_THRESHOLD:
+ *
+ * Gets the light levels that wake the host, as set by
+ * CH_CMD_SET_WAKE_THRESHOLD.
+ *
+ * IN:  [1:cmd]
+ * OUT: [1:retval][1:cmd][4:low][4:high][2:integral_time]
+ *
+ * This command is only available in firmware mode.
+ **/
+#define	CH_CMD_GET_WAKE_THRESHOLD		0x63
+
+/**
+ * CH_CMD_SET_WAKE_THRESHOLD:
+ *
+ * Sets the light levels that wake the host from suspend. While the bus
+ * is suspended and the host has enabled remote wakeup, the device takes
+ * a reading with @integral_time about once a second, powering the sensor
+ * up for it at the last multiplier that was set. If the count is below
+ * @low or above @high then the device signals remote wakeup.
+ *
+ * The count is the same as @count from CH_CMD_TAKE_READING_RAW with the
+ * current color select and edge mode. An @integral_time of 0 turns this
+ * off, which is the default, and it can be at most
+ * CH_WAKE_INTEGRAL_TIME_MAX to stay within the suspend current.
+ *
+ * IN:  [1:cmd][4:low][4:high][2:integral_time]
+ * OUT: [1:retval][1:cmd]
+ *
+ * This command is only available in firmware mode.
+ **/
+#define	CH_CMD_SET_WAKE_THRESHOLD		0x64
+
+/**
+ * CH_CMD_SET_PROGRAM:
+ *
+ * Uploads a program of up to CH_PROGRAM_STEPS_MAX steps, which is run by
+ * CH_CMD_RUN_PROGRAM. This stops any program that is running.
+ *
+ * Each step sets the color select and multiplier and takes a reading
+ * with its integral time, and is started @interval ms after the last.
+ * All the steps are run @repeat times, or until the program is stopped
+ * if @repeat is 0.
+ *
+ * Each step is [1:color_select][1:multiplier][2:integral_time], and the
+ * multiplier and integral time cannot be 0.
+ *
+ * IN:  [1:cmd][2:repeat][2:interval][1:steps][4*steps:step]
+ * OUT: [1:retval][1:cmd]
+ *
+ * This command is only available in firmware mode.
+ **/
+#define	CH_CMD_SET_PROGRAM			0x65
+
+/**
+ * CH_CMD_RUN_PROGRAM:
+ *
+ * Starts the program from the first step if @enable is 1, discarding
+ * any results that have not been collected, or stops it if @enable is 0.
+ * The color select and multiplier are restored when the program ends.
+ *
+ * CH_ERROR_INVALID_VALUE is returned if the interval is not longer than
+ * the reading of any step, as for CH_CMD_SET_STREAM, so that commands
+ * are still answered while the program runs.
+ *
+ * IN:  [1:cmd][1:enable]
+ * OUT: [1:retval][1:cmd]
+ *
+ * This command is only available in firmware mode.
+ **/
+#define	CH_CMD_RUN_PROGRAM			0x66
+
+/**
+ * CH_CMD_GET_PROGRAM_RESULTS:
+ *
+ * Gets the oldest results of the program, which are then removed. Each
+ * is @count from the reading, or @corrected if that is dark subtracted.
+ * Up to CH_PROGRAM_RESULTS_MAX results are kept for the host, and
+ * readings are dropped rather than the program being slowed down if it
+ * has not collected them in time.
+ *
+ * @state has CH_PROGRAM_STATE_RUNNING set until the program ends, and
+ * CH_PROGRAM_STATE_OVERFLOW if readings were dropped since the last time
+ * the results were collected.
+ *
+ * IN:  [1:cmd]
+ * OUT: [1:retval][1:cmd][1:state][1:results][4*results:result]
+ *
+ * This command is only available in firmware mode.
+ **/
+#define	CH_CMD_GET_PROGRAM_RESULTS		0x67
+
 /* secret code, which is actually encoded as '84f40464' */
 #define	CH_FIRMWARE_ID_TOKEN			"8f06"
 
 /* input and output buffer offsets */
 #define	CH_BUFFER_INPUT_CMD			0x00
 #define	CH_BUFFER_INPUT_DATA			0x01
+#define	CH_BUFFER_INPUT_SEQUENCE		0x3f
 #define	CH_BUFFER_OUTPUT_RETVAL			0x00
 #define	CH_BUFFER_OUTPUT_CMD			0x01
 #define	CH_BUFFER_OUTPUT_DATA			0x02
+#define	CH_BUFFER_OUTPUT_SEQUENCE		0x3f
+
+/* set in the cmd byte to echo the sequence ID in the last byte of the
+ * reply, so replies to queued commands can be matched up by the host */
+#define	CH_CMD_FLAG_SEQUENCE			0x80
 
 /* where the custom firmware is stored */
 #define CH_EEPROM_ADDR_RUNCODE			0x2000	/* bytes */
@@ -317,6 +819,27 @@
 /* this is a whole seporate block at the end of the flash */
 #define	CH_EEPROM_ADDR_FLASH_SUCCESS		0x3f80	/* bytes (in f/w) */
 
+/* where CHugFatalError() records the last fault */
+#define	CH_EEPROM_ADDR_FAULT_LOG		0x3f40	/* bytes (in f/w) */
+#define	CH_FAULT_LOG_SIZE			10	/* bytes */
+#define	CH_FAULT_LOG_EMPTY			0x3fff
+
+/* the dark offsets for each multiplier and color, see
+ * CH_CMD_TAKE_DARK_CALIBRATION */
+#define	CH_EEPROM_ADDR_DARK_OFFSETS		0x3fc0	/* bytes (in f/w) */
+#define	CH_DARK_OFFSETS_SIZE			32	/* bytes */
+#define	CH_DARK_OFFSET_NONE			0x3fff
+#define	CH_DARK_OFFSET_MAX			0x3ffe
+#define	CH_DARK_OFFSET_SHIFT			18
+
+/* the temperature coefficients, in the same block as the dark offsets */
+#define	CH_EEPROM_ADDR_TEMP_COEFFICIENTS	0x3fe0	/* bytes (in f/w) */
+#define	CH_TEMP_COEFFICIENTS_SIZE		10	/* bytes */
+#define	CH_TEMP_COEFFICIENT_MAX			8191
+
+/* no temperature could be read */
+#define	CH_TEMPERATURE_UNKNOWN			0x7fff
+
 #define CH_COLOR_OFFSET_RED			0x00
 #define CH_COLOR_OFFSET_GREEN			0x01
 #define CH_COLOR_OFFSET_BLUE			0x02
@@ -334,6 +857,41 @@ typedef enum {
 	CH_COLOR_SELECT_GREEN
 } ChColorSelect;
 
+/* how long to wait in ms before acting on a deferred command */
+#define	CH_DEVICE_IDLE_DELAY			10
+
+/* how long in ms the sensor is left powered up after a reading */
+#define	CH_SENSOR_POWER_TIMEOUT_DEFAULT		5000
+
+/* the longest reading taken while the bus is suspended, about 30ms */
+#define	CH_WAKE_INTEGRAL_TIME_MAX		0x1000
+
+/* the wValue high byte of GET_REPORT and SET_REPORT */
+#define	CH_HID_REPORT_TYPE_FEATURE		0x03
+
+/* flags for CH_CMD_SET_STREAM */
+#define	CH_STREAM_FLAG_BULK			0x01
+
+/* flags for CH_CMD_TAKE_READING_RAW and the other readings */
+#define	CH_READING_FLAG_BOTH_EDGES		0x80
+#define	CH_READING_FLAG_DARK_SUBTRACTED		0x40
+#define	CH_READING_FLAG_TEMP_COMPENSATED	0x20
+
+/* limits and flags for CH_CMD_SET_PROGRAM and the results */
+#define	CH_PROGRAM_STEPS_MAX			8
+#define	CH_PROGRAM_RESULTS_MAX			8	/* must be a power of 2 */
+#define	CH_PROGRAM_RESULTS_PER_FETCH		8
+#define	CH_PROGRAM_STATE_RUNNING		0x01
+#define	CH_PROGRAM_STATE_OVERFLOW		0x02
+
+/* flags for CH_CMD_GET_STATS */
+#define	CH_STATS_FLAG_RESET			0x01
+#define	CH_STATS_PAGE_COUNTERS			0x00
+#define	CH_STATS_PAGE_COMMANDS			0x01
+
+/* flash the LEDs until told otherwise */
+#define	CH_LED_REPEAT_FOREVER			0xff
+
 /* which color to select */
 typedef enum {
 	CH_STATUS_LED_GREEN	= 1,
@@ -348,6 +906,12 @@ typedef enum {
 	CH_FREQ_SCALE_100
 } ChFreqScale;
 
+/* which edges of the sensor output to count */
+typedef enum {
+	CH_EDGE_MODE_RISING,
+	CH_EDGE_MODE_BOTH
+} ChEdgeMode;
+
 /* fatal error morse code */
 typedef enum {
 	CH_ERROR_NONE,
@@ -376,7 +940,10 @@ typedef enum {
 	CH_ERROR_SELF_TEST_COLOR_SELECT,
 	CH_ERROR_SELF_TEST_MULTIPLIER,
 	CH_ERROR_INVALID_CALIBRATION,
+	CH_ERROR_OUT_OF_MEMORY = 27,
 	CH_ERROR_SELF_TEST_EEPROM = 35,
+	CH_ERROR_BUSY,
+	CH_ERROR_NOT_ARMED,
 	CH_ERROR_LAST
 } ChError;
 
@@ -29,7 +29,11 @@
 #include "usb_config.h"
 #include "ch-common.h"
 #include "ch-flash.h"
+#include "ch-led.h"
+#include "ch-sched.h"
 #include "ch-self-test.h"
+#include "ch-tick.h"
+#include "ch-trace.h"
 
 #include <delays.h>
 #include <USB/usb.h>
@@ -43,7 +47,6 @@ __CONFIG(WRT_HALF & CPUDIV_NOCLKDIV & USBLSCLK_48MHz & PLLMULT_3x & PLLEN_ENABLE
 
 /* USB idle support */
 static uint8_t idle_command = 0x00;
-static uint8_t idle_counter = 0x00;
 
 /* USB buffers */
 uint8_t RxBuffer[CH_USB_HID_EP_SIZE];
@@ -52,6 +55,13 @@ uint8_t TxBuffer[CH_USB_HID_EP_SIZE];
 USB_HANDLE	USBOutHandle = 0;
 USB_HANDLE	USBInHandle = 0;
 
+/* USB buffers for the vendor interface */
+uint8_t BulkRxBuffer[CH_USB_BULK_EP_SIZE];
+uint8_t BulkTxBuffer[CH_USB_BULK_EP_SIZE];
+
+USB_HANDLE	USBBulkOutHandle = 0;
+USB_HANDLE	USBBulkInHandle = 0;
+
 /**
  * ISRCode:
  **/
@@ -74,7 +84,7 @@ CHugBootFlash(void)
  * CHugCalculateChecksum:
  **/
 static uint8_t
-CHugCalculateChecksum(uint8_t *data, uint8_t length)
+CHugCalculateChecksum(const uint8_t *data, uint8_t length)
 {
 	int i;
 	uint8_t checksum = 0xff;
@@ -89,6 +99,13 @@ CHugCalculateChecksum(uint8_t *data, uint8_t length)
 static void
 CHugDeviceIdle(void)
 {
+	/* wait for the host to collect the reply */
+	if (HIDTxHandleBusy(USBInHandle) ||
+	    USBHandleBusy(USBBulkInHandle)) {
+		CHugSchedAdd(CHugDeviceIdle, CH_DEVICE_IDLE_DELAY, 0);
+		return;
+	}
+
 	switch (idle_command) {
 	case CH_CMD_RESET:
 		RESET();
@@ -101,10 +118,12 @@ CHugDeviceIdle(void)
 }
 
 /**
- * ProcessIO:
+ * CHugProcessCommand:
+ * @rx: the request from the host
+ * @tx: the reply to send
  **/
 static void
-ProcessIO(void)
+CHugProcessCommand(const uint8_t *rx, uint8_t *tx)
 {
 	uint16_t address;
 	uint16_t erase_length;
@@ -112,50 +131,41 @@ ProcessIO(void)
 	uint8_t checksum;
 	uint8_t cmd;
 	uint8_t rc = CH_ERROR_NONE;
-	static uint16_t led_counter = 0x0;
-
-	/* reset the LED state */
-	if (--led_counter == 0) {
-		PORTCbits.RC5 ^= 1;
-		led_counter = 0x2fff;
-	}
-
-	/* User Application USB tasks */
-	if ((USBDeviceState < CONFIGURED_STATE) ||
-	    (USBSuspendControl == 1))
-		return;
-
-	/* no data was received */
-	if (HIDRxHandleBusy(USBOutHandle)) {
-		if (idle_counter++ == 0xff &&
-		    idle_command != 0x00)
-			CHugDeviceIdle();
-		return;
-	}
-
-	/* got data, reset idle counter */
-	idle_counter = 0;
 
 	/* clear for debugging */
-	memset (TxBuffer, 0xff, sizeof (TxBuffer));
-
-	cmd = RxBuffer[CH_BUFFER_INPUT_CMD];
-	switch(cmd) {
+	memset (tx, 0xff, CH_USB_HID_EP_SIZE);
+
+	cmd = rx[CH_BUFFER_INPUT_CMD];
+	switch(cmd & ~CH_CMD_FLAG_SEQUENCE) {
+	case CH_CMD_GET_FAULT_LOG:
+		rc = CHugFlashRead(CH_EEPROM_ADDR_FAULT_LOG,
+				   CH_FAULT_LOG_SIZE,
+				   &tx[CH_BUFFER_OUTPUT_DATA]);
+		break;
+	case CH_CMD_CLEAR_FAULT_LOG:
+		rc = CHugFlashErase(CH_EEPROM_ADDR_FAULT_LOG,
+				    CH_FLASH_ERASE_BLOCK_SIZE);
+		break;
+	case CH_CMD_GET_TRACE:
+		rc = CHugTraceGetChunk(rx[CH_BUFFER_INPUT_DATA],
+				       &tx[CH_BUFFER_OUTPUT_DATA]);
+		break;
 	case CH_CMD_GET_HARDWARE_VERSION:
-		TxBuffer[CH_BUFFER_OUTPUT_DATA] = 0x04;
+		tx[CH_BUFFER_OUTPUT_DATA] = 0x04;
 		break;
 	case CH_CMD_RESET:
 		/* only reset when USB stack is not busy */
 		idle_command = CH_CMD_RESET;
+		rc = CHugSchedAdd(CHugDeviceIdle, CH_DEVICE_IDLE_DELAY, 0);
 		break;
 	case CH_CMD_GET_FIRMWARE_VERSION:
-		*((uint16_t *) &TxBuffer[CH_BUFFER_OUTPUT_DATA + 0]) = CH_VERSION_MAJOR;
-		*((uint16_t *) &TxBuffer[CH_BUFFER_OUTPUT_DATA + 2]) = CH_VERSION_MINOR;
-		*((uint16_t *) &TxBuffer[CH_BUFFER_OUTPUT_DATA + 4]) = CH_VERSION_MICRO;
+		*((uint16_t *) &tx[CH_BUFFER_OUTPUT_DATA + 0]) = CH_VERSION_MAJOR;
+		*((uint16_t *) &tx[CH_BUFFER_OUTPUT_DATA + 2]) = CH_VERSION_MINOR;
+		*((uint16_t *) &tx[CH_BUFFER_OUTPUT_DATA + 4]) = CH_VERSION_MICRO;
 		break;
 	case CH_CMD_ERASE_FLASH:
 		memcpy (&address,
-			(const void *) &RxBuffer[CH_BUFFER_INPUT_DATA+0],
+			(const void *) &rx[CH_BUFFER_INPUT_DATA+0],
 			2);
 		/* allow to erase any address but not the bootloader */
 		if (address < CH_EEPROM_ADDR_RUNCODE ||
@@ -164,56 +174,57 @@ ProcessIO(void)
 			break;
 		}
 		memcpy (&erase_length,
-			(const void *) &RxBuffer[CH_BUFFER_INPUT_DATA+2],
+			(const void *) &rx[CH_BUFFER_INPUT_DATA+2],
 			2);
 		rc = CHugFlashErase(address, erase_length);
 		break;
 	case CH_CMD_READ_FLASH:
 		/* allow to read any address */
 		memcpy (&address,
-			(const void *) &RxBuffer[CH_BUFFER_INPUT_DATA+0],
+			(const void *) &rx[CH_BUFFER_INPUT_DATA+0],
 			2);
-		length = RxBuffer[CH_BUFFER_INPUT_DATA+2];
+		length = rx[CH_BUFFER_INPUT_DATA+2];
 		if (length > 60) {
 			rc = CH_ERROR_INVALID_LENGTH;
 			break;
 		}
 		rc = CHugFlashRead(address, length,
-				   &TxBuffer[CH_BUFFER_OUTPUT_DATA+1]);
-		checksum = CHugCalculateChecksum (&TxBuffer[CH_BUFFER_OUTPUT_DATA+1],
+				   &tx[CH_BUFFER_OUTPUT_DATA+1]);
+		checksum = CHugCalculateChecksum (&tx[CH_BUFFER_OUTPUT_DATA+1],
 						  length);
-		TxBuffer[CH_BUFFER_OUTPUT_DATA+0] = checksum;
+		tx[CH_BUFFER_OUTPUT_DATA+0] = checksum;
 		break;
 	case CH_CMD_WRITE_FLASH:
 		/* write to flash that's not the bootloader */
 		memcpy (&address,
-			(const void *) &RxBuffer[CH_BUFFER_INPUT_DATA+0],
+			(const void *) &rx[CH_BUFFER_INPUT_DATA+0],
 			2);
 		if (address < CH_EEPROM_ADDR_RUNCODE ||
 		    address > CH_EEPROM_ADDR_MAX) {
 			rc = CH_ERROR_INVALID_ADDRESS;
 			break;
 		}
-		length = RxBuffer[CH_BUFFER_INPUT_DATA+2];
+		length = rx[CH_BUFFER_INPUT_DATA+2];
 		if (length > CH_FLASH_TRANSFER_BLOCK_SIZE) {
 			rc = CH_ERROR_INVALID_LENGTH;
 			break;
 		}
-		checksum = CHugCalculateChecksum(&RxBuffer[CH_BUFFER_INPUT_DATA+4],
+		checksum = CHugCalculateChecksum(&rx[CH_BUFFER_INPUT_DATA+4],
 						 length);
-		if (checksum != RxBuffer[CH_BUFFER_INPUT_DATA+3]) {
+		if (checksum != rx[CH_BUFFER_INPUT_DATA+3]) {
 			rc = CH_ERROR_INVALID_CHECKSUM;
 			break;
 		}
 		rc = CHugFlashWrite(address, length,
-				    &RxBuffer[CH_BUFFER_INPUT_DATA+4]);
+				    &rx[CH_BUFFER_INPUT_DATA+4]);
 		break;
 	case CH_CMD_BOOT_FLASH:
 		/* only boot when USB stack is not busy */
 		idle_command = CH_CMD_BOOT_FLASH;
+		rc = CHugSchedAdd(CHugDeviceIdle, CH_DEVICE_IDLE_DELAY, 0);
 		break;
 	case CH_CMD_SET_FLASH_SUCCESS:
-		if (RxBuffer[CH_BUFFER_INPUT_DATA] != 0x00) {
+		if (rx[CH_BUFFER_INPUT_DATA] != 0x00) {
 			rc = CH_ERROR_INVALID_VALUE;
 			break;
 		}
@@ -222,7 +233,7 @@ ProcessIO(void)
 		if (rc != CH_ERROR_NONE)
 			break;
 		rc = CHugFlashWrite(CH_EEPROM_ADDR_FLASH_SUCCESS, 1,
-				    &RxBuffer[CH_BUFFER_INPUT_DATA]);
+				    &rx[CH_BUFFER_INPUT_DATA]);
 		break;
 	case CH_CMD_SELF_TEST:
 		rc = CHugSelfTest();
@@ -232,19 +243,70 @@ ProcessIO(void)
 		break;
 	}
 
-	/* always send return code */
-	if(!HIDTxHandleBusy(USBInHandle)) {
-		TxBuffer[CH_BUFFER_OUTPUT_RETVAL] = rc;
-		TxBuffer[CH_BUFFER_OUTPUT_CMD] = cmd;
-		USBInHandle = HIDTxPacket(HID_EP,
-					  (BYTE*)&TxBuffer[0],
-					  CH_USB_HID_EP_SIZE);
+	tx[CH_BUFFER_OUTPUT_RETVAL] = rc;
+	tx[CH_BUFFER_OUTPUT_CMD] = cmd;
+	if (cmd & CH_CMD_FLAG_SEQUENCE)
+		tx[CH_BUFFER_OUTPUT_SEQUENCE] = rx[CH_BUFFER_INPUT_SEQUENCE];
+}
+
+/**
+ * CHugTraceCommand:
+ *
+ * Handles a command, recording it in the trace.
+ **/
+static void
+CHugTraceCommand(const uint8_t *rx, uint8_t *tx)
+{
+	uint32_t start = CHugTickGetCycles32();
+
+	CHugProcessCommand(rx, tx);
+	CHugTraceAdd(tx[CH_BUFFER_OUTPUT_CMD],
+		     tx[CH_BUFFER_OUTPUT_RETVAL],
+		     start,
+		     CHugTickGetCycles32() - start);
+}
+
+/**
+ * ProcessIO:
+ **/
+static void
+ProcessIO(void)
+{
+	/* User Application USB tasks */
+	if ((USBDeviceState < CONFIGURED_STATE) ||
+	    (USBSuspendControl == 1))
+		return;
+
+	/* data was received on the HID interface */
+	if (!HIDRxHandleBusy(USBOutHandle)) {
+		CHugTraceCommand(RxBuffer, TxBuffer);
+
+		/* always send return code */
+		if(!HIDTxHandleBusy(USBInHandle)) {
+			USBInHandle = HIDTxPacket(HID_EP,
+						  (BYTE*)&TxBuffer[0],
+						  CH_USB_HID_EP_SIZE);
+		}
+
+		/* re-arm the OUT endpoint for the next packet */
+		USBOutHandle = HIDRxPacket(HID_EP,
+					   (BYTE*)&RxBuffer,
+					   CH_USB_HID_EP_SIZE);
 	}
 
-	/* re-arm the OUT endpoint for the next packet */
-	USBOutHandle = HIDRxPacket(HID_EP,
-				   (BYTE*)&RxBuffer,
-				   CH_USB_HID_EP_SIZE);
+	/* data was received on the vendor interface, which is left
+	 * pending until the host has read the last reply, so the host
+	 * gets a NAK rather than losing the reply */
+	if (!USBHandleBusy(USBBulkOutHandle) &&
+	    !USBHandleBusy(USBBulkInHandle)) {
+		CHugTraceCommand(BulkRxBuffer, BulkTxBuffer);
+		USBBulkInHandle = USBTxOnePacket(VENDOR_EP,
+						 (BYTE*)&BulkTxBuffer[0],
+						 CH_USB_BULK_EP_SIZE);
+		USBBulkOutHandle = USBRxOnePacket(VENDOR_EP,
+						  (BYTE*)&BulkRxBuffer,
+						  CH_USB_BULK_EP_SIZE);
+	}
 }
 
 /**
@@ -276,6 +338,16 @@ USER_USB_CALLBACK_EVENT_HANDLER(int event, void *pdata, WORD size)
 		USBOutHandle = HIDRxPacket(HID_EP,
 					   (BYTE*)&RxBuffer,
 					   CH_USB_HID_EP_SIZE);
+
+		/* enable the bulk endpoints on the vendor interface */
+		USBEnableEndpoint(VENDOR_EP,
+				  USB_IN_ENABLED|
+				  USB_OUT_ENABLED|
+				  USB_HANDSHAKE_ENABLED|
+				  USB_DISALLOW_SETUP);
+		USBBulkOutHandle = USBRxOnePacket(VENDOR_EP,
+						  (BYTE*)&BulkRxBuffer,
+						  CH_USB_BULK_EP_SIZE);
 		break;
 	case EVENT_EP0_REQUEST:
 		USBCheckHIDRequest();
@@ -296,6 +368,7 @@ main(void)
 {
 	uint16_t runcode_start = 0x3f3f;
 	uint8_t flash_success = 0xff;
+	uint16_t fault_error = CH_FAULT_LOG_EMPTY;
 
 	/* switch ports to digital mode */
 	ANSELA = 0x00;
@@ -351,6 +424,17 @@ main(void)
 	    flash_success == 0x01)
 		CHugBootFlash();
 
+	/* flash the LEDs to show we're in bootloader mode, and faster
+	 * if the firmware crashed */
+	CHugTickInit();
+	CHugSchedAdd(CHugLedTick, 1, 1);
+	CHugFlashRead(CH_EEPROM_ADDR_FAULT_LOG, 2,
+		      (uint8_t *) &fault_error);
+	if (fault_error != CH_FAULT_LOG_EMPTY)
+		CHugLedSetPattern(1, CH_LED_REPEAT_FOREVER, 50, 200);
+	else
+		CHugLedSetPattern(1, CH_LED_REPEAT_FOREVER, 200, 200);
+
 	/* Initializes USB module SFRs and firmware variables to known states */
 	USBDeviceInit();
 	USBDeviceAttach();
@@ -364,5 +448,8 @@ main(void)
 		USBDeviceTasks();
 
 		ProcessIO();
+
+		/* run any timers that have expired */
+		CHugSchedRun();
 	}
 }
@@ -82,26 +82,62 @@ CHugSetLEDs(uint8_t leds)
 	PORTCbits.RC5 = leds;
 }
 
+/* written to CH_EEPROM_ADDR_FAULT_LOG, where each word only stores
+ * 14 bits and so no value can be larger than 0x3fff */
+typedef struct {
+	uint16_t	 error;
+	uint16_t	 pcon;
+	uint16_t	 stkptr;
+	uint16_t	 tos;		/* the caller of CHugFatalError() */
+	uint16_t	 count;
+} ChFaultLog;
+
 /**
  * CHugFatalError:
+ *
+ * Records the error and the state of the device in the fault log, shows
+ * the error on the LED once and then resets into the bootloader, which
+ * can report the fault log to the host.
  **/
 void
 CHugFatalError (ChError error)
 {
+	ChFaultLog log;
 	uint8_t i;
 
+	/* nothing else is going to run */
+	INTCONbits.GIE = 0;
+
 	/* turn off watchdog */
 	WDTCONbits.SWDTEN = 0;
 	TRISC = 0xdf;
 
-	while (1) {
-		for (i = 0; i < error; i++) {
-			CHugSetLEDs(1);
-			Delay10KTCYx(0xff);
-			CHugSetLEDs(0);
-			Delay10KTCYx(0xff);
-		}
+	/* keep counting faults until the log is cleared */
+	CHugFlashRead(CH_EEPROM_ADDR_FAULT_LOG,
+		      sizeof(ChFaultLog),
+		      (uint8_t *) &log);
+	if (log.count >= CH_FAULT_LOG_EMPTY)
+		log.count = 0;
+	if (log.count < CH_FAULT_LOG_EMPTY - 1)
+		log.count++;
+	log.error = error;
+	log.pcon = PCON;
+	log.stkptr = STKPTR;
+	log.tos = ((uint16_t) (TOSH & 0x3f) << 8) | TOSL;
+	CHugFlashErase(CH_EEPROM_ADDR_FAULT_LOG, CH_FLASH_ERASE_BLOCK_SIZE);
+	CHugFlashWrite(CH_EEPROM_ADDR_FAULT_LOG,
+		       sizeof(ChFaultLog),
+		       (const uint8_t *) &log);
+
+	for (i = 0; i < error; i++) {
+		CHugSetLEDs(1);
 		Delay10KTCYx(0xff);
+		CHugSetLEDs(0);
 		Delay10KTCYx(0xff);
 	}
+
+	/* clear the stack and watchdog flags so the bootloader does not
+	 * fail again, and RESET clears nRI so the firmware is not booted */
+	PCON = 0x1f;
+	RESET();
 }
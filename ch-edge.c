@@ -0,0 +1,149 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Counts the rising edges of the TCS3200 output on RA4. PORTA also has
+ * the USB D+ and D- lines, so only RA4 is ever looked at, and the loop
+ * takes the same number of cycles whatever the pin does so a number of
+ * samples is always the same length of time.
+ */
+
+#include "ColorHug.h"
+
+#include "ch-edge.h"
+#include "ch-hal.h"
+
+typedef struct {
+	uint8_t		 left[3];	/* samples to take after this one */
+	uint8_t		 edges[3];	/* counted down from zero */
+	uint8_t		 prev;		/* RA4 in the last sample */
+} ChEdgeKernel;
+
+/* kept together so the kernel only has to select one bank */
+static ChEdgeKernel	kernel;
+
+/**
+ * CHugEdgeWaitRising:
+ * @samples: the most times to look at the output
+ *
+ * Waits for the output to go high, so a count starts on a new pulse
+ * which gives more accurate black readings.
+ *
+ * Returns: %false if the output did not go from low to high
+ **/
+bool
+CHugEdgeWaitRising(uint16_t samples)
+{
+	uint8_t prev = CH_HAL_SENSOR_OUT;
+	uint8_t now;
+
+	for (; samples > 0; samples--) {
+		now = CH_HAL_SENSOR_OUT;
+		if (now > prev)
+			return true;
+		prev = now;
+	}
+	return false;
+}
+
+/**
+ * CHugEdgeCount:
+ * @samples: the number of samples to take, up to CH_EDGE_SAMPLES_MAX
+ * @both_edges: count the falling edges too
+ *
+ * Samples RA4 every CH_EDGE_CYCLES_PER_SAMPLE cycles, counting the times
+ * it was low in one sample and high in the next. The counters are 16 bits
+ * with a byte of carry so that no sample has to test for an overflow.
+ *
+ * The falling edges are not counted in the loop, as there is one for
+ * each rising edge apart from at the ends: the count of both is twice
+ * the rising edges, plus one if the output started high and less one if
+ * it finished high. This keeps the time of each sample the same.
+ *
+ * Returns: the number of edges
+ **/
+uint32_t
+CHugEdgeCount(uint32_t samples, bool both_edges)
+{
+	uint32_t tmp;
+	uint8_t first;
+
+	if (samples == 0)
+		return 0;
+	if (samples > CH_EDGE_SAMPLES_MAX)
+		samples = CH_EDGE_SAMPLES_MAX;
+	samples--;
+	kernel.left[0] = samples & 0xff;
+	kernel.left[1] = (samples >> 8) & 0xff;
+	kernel.left[2] = (samples >> 16) & 0xff;
+	kernel.edges[0] = 0;
+	kernel.edges[1] = 0;
+	kernel.edges[2] = 0;
+	kernel.prev = CH_HAL_SENSOR_OUT ? 0x10 : 0x00;
+	first = kernel.prev;
+
+#if defined(COLORHUG_HOST)
+	do {
+		uint8_t now = CH_HAL_SENSOR_SAMPLE(CH_EDGE_CYCLES_PER_SAMPLE) ? 0x10 : 0x00;
+		if (now > kernel.prev) {
+			if (kernel.edges[0]-- == 0 && kernel.edges[1]-- == 0)
+				kernel.edges[2]--;
+		}
+		kernel.prev = now;
+	} while (samples-- != 0);
+#else
+	/* 15 cycles for each sample, and 14 for the last */
+	asm("movlw low(_PORTA)");
+	asm("movwf _FSR0L");
+	asm("movlw high(_PORTA)");
+	asm("movwf _FSR0H");
+	asm("BANKSEL (_kernel)");
+	asm("l_edge_sample:");
+	asm("movf _INDF0, w");			/* PORTA, without changing bank */
+	asm("andlw 0x10");			/* only RA4 */
+	asm("subwf (_kernel+6)&07Fh, f");	/* borrows if low then high */
+	asm("movwf (_kernel+6)&07Fh");
+	asm("clrw");
+	asm("subwfb (_kernel+3)&07Fh, f");	/* edges -= borrow */
+	asm("subwfb (_kernel+4)&07Fh, f");
+	asm("subwfb (_kernel+5)&07Fh, f");	/* the carry byte */
+	asm("movlw 0xff");
+	asm("addwf (_kernel+0)&07Fh, f");	/* left -= 1 */
+	asm("addwfc (_kernel+1)&07Fh, f");
+	asm("addwfc (_kernel+2)&07Fh, f");
+	asm("btfsc _STATUS, 0");		/* no carry once left was 0 */
+	asm("goto l_edge_sample");
+#endif
+
+	/* the edges were counted down */
+	tmp = ((uint32_t) kernel.edges[2] << 16) |
+	      ((uint32_t) kernel.edges[1] << 8) |
+	      kernel.edges[0];
+	tmp = (0x1000000UL - tmp) & CH_EDGE_SAMPLES_MAX;
+	if (!both_edges)
+		return tmp;
+	tmp *= 2;
+	if (first != 0)
+		tmp++;
+	if (kernel.prev != 0)
+		tmp--;
+	return tmp;
+}
@@ -0,0 +1,44 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __CH_EDGE_H
+#define __CH_EDGE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* every sample of RA4 takes exactly this many instruction cycles */
+#define	CH_EDGE_CYCLES_PER_SAMPLE		15
+
+/* the output must stay high and low for a sample each to be counted */
+#define	CH_EDGE_MAX_FREQUENCY			400000	/* Hz */
+
+/* an integral time of 0xffff still takes about 500ms */
+#define	CH_EDGE_SAMPLES_PER_INTEGRAL_TIME	6
+
+/* the most samples that can be taken at once */
+#define	CH_EDGE_SAMPLES_MAX			0xffffffUL
+
+bool		 CHugEdgeWaitRising	(uint16_t	 samples);
+uint32_t	 CHugEdgeCount		(uint32_t	 samples,
+					 bool		 both_edges);
+
+#endif /* __CH_EDGE_H */
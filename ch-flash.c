@@ -21,7 +21,26 @@
 
 #include "ColorHug.h"
 
+#include <string.h>
+
 #include "ch-flash.h"
+#include "ch-hal.h"
+
+/**
+ * CHugFlashUnlock:
+ *
+ * Starts the erase or write set up in PMCON1, which stalls the CPU until
+ * it completes. The unlock sequence must not be interrupted.
+ **/
+static void
+CHugFlashUnlock(void)
+{
+	uint8_t gie = INTCONbits.GIE;
+
+	INTCONbits.GIE = 0;
+	CH_HAL_FLASH_START();
+	CH_HAL_SET_GIE(gie);
+}
 
 /**
  * CHugFlashErase:
@@ -42,17 +61,13 @@ CHugFlashErase(uint16_t addr, uint16_t len)
 	/* PMADR is addressed as words, not as bytes */
 	addr /= 2;
 
-	/* erase in chunks of 32 words */
-	for (i = 0; i < len; i += 32) {
+	/* erase in rows of 32 words, with @i still counting bytes */
+	for (i = 0; i < len; i += CH_FLASH_ERASE_BLOCK_SIZE) {
 		PMCON1bits.CFGS = 0;
 		PMCON1bits.FREE = 1;
 		PMCON1bits.WREN = 1;
-		PMADR = addr + i;
-		PMCON2 = 0x55;
-		PMCON2 = 0xAA;
-		PMCON1bits.WR = 1;
-		asm("nop");
-		asm("nop");
+		PMADR = addr + i / 2;
+		CHugFlashUnlock();
 	}
 	PMCON1bits.WREN = 0;
 	return CH_ERROR_NONE;
@@ -83,11 +98,7 @@ CHugFlashWrite(uint16_t addr, uint16_t len, const uint8_t *data)
 		PMDATL = data[i];
 		if (i + 1 < len)
 			PMDATH = data[i + 1];
-		PMCON2 = 0x55;
-		PMCON2 = 0xAA;
-		PMCON1bits.WR = 1;
-		asm("nop");
-		asm("nop");
+		CHugFlashUnlock();
 	}
 	PMCON1bits.WREN = 0;
 
@@ -119,9 +130,7 @@ CHugFlashRead(uint16_t addr, uint16_t len, uint8_t *data)
 	for (i = 0; i < len; i += 2) {
 		PMADR = addr++;
 		PMCON1bits.CFGS = 0;
-		PMCON1bits.RD = 1;
-		asm("nop");
-		asm("nop");
+		CH_HAL_FLASH_READ();
 		data[i] = PMDATL;
 		/* odd number of bytes to read */
 		if (i + 1 >= len)
@@ -130,3 +139,28 @@ CHugFlashRead(uint16_t addr, uint16_t len, uint8_t *data)
 	}
 	return CH_ERROR_NONE;
 }
+
+/**
+ * CHugFlashUpdate:
+ *
+ * Writes @len bytes at @addr, keeping the rest of the erase block they
+ * are in, so that a block can be shared by several settings.
+ **/
+uint8_t
+CHugFlashUpdate(uint16_t addr, uint16_t len, const uint8_t *data)
+{
+	uint16_t start = addr & ~(CH_FLASH_ERASE_BLOCK_SIZE - 1);
+	uint8_t block[CH_FLASH_ERASE_BLOCK_SIZE];
+	uint8_t rc;
+
+	if (addr - start + len > CH_FLASH_ERASE_BLOCK_SIZE)
+		return CH_ERROR_INVALID_LENGTH;
+	rc = CHugFlashRead(start, CH_FLASH_ERASE_BLOCK_SIZE, block);
+	if (rc != CH_ERROR_NONE)
+		return rc;
+	memcpy (&block[addr - start], data, len);
+	rc = CHugFlashErase(start, CH_FLASH_ERASE_BLOCK_SIZE);
+	if (rc != CH_ERROR_NONE)
+		return rc;
+	return CHugFlashWrite(start, CH_FLASH_ERASE_BLOCK_SIZE, block);
+}
@@ -32,5 +32,8 @@ uint8_t		 CHugFlashWrite		(uint16_t	 addr,
 uint8_t		 CHugFlashRead		(uint16_t	 addr,
 					 uint16_t	 len,
 					 uint8_t	*data);
+uint8_t		 CHugFlashUpdate	(uint16_t	 addr,
+					 uint16_t	 len,
+					 const uint8_t	*data);
 
 #endif /* __CH_FLASH_H */
@@ -0,0 +1,87 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __CH_HAL_H
+#define __CH_HAL_H
+
+/*
+ * The hardware that changes by itself, or that does something when it
+ * is written to, is only accessed through these macros. This allows the
+ * firmware to be built for the host with COLORHUG_HOST, where the rest of
+ * the registers are plain variables and these call into a simulation.
+ */
+
+#if defined(COLORHUG_HOST)
+
+#include <stdint.h>
+
+uint8_t		 CHugHalReadPortA	(void);
+uint8_t		 CHugHalSampleSensor	(uint8_t cycles);
+void		 CHugHalFlashStart	(void);
+void		 CHugHalFlashRead	(void);
+void		 CHugHalSetGie		(uint8_t gie);
+void		 CHugHalAdcConvert	(void);
+
+#define	CH_HAL_PORTA			CHugHalReadPortA()
+#define	CH_HAL_SENSOR_OUT		((CHugHalReadPortA() >> 4) & 0x01)
+#define	CH_HAL_SENSOR_SAMPLE(cycles)	CHugHalSampleSensor(cycles)
+#define	CH_HAL_FLASH_START()		CHugHalFlashStart()
+#define	CH_HAL_FLASH_READ()		CHugHalFlashRead()
+#define	CH_HAL_SET_GIE(gie)		CHugHalSetGie(gie)
+#define	CH_HAL_ADC_CONVERT()		CHugHalAdcConvert()
+
+#else
+
+/* the TCS3200 output is on RA4 */
+#define	CH_HAL_PORTA			PORTA
+#define	CH_HAL_SENSOR_OUT		PORTAbits.RA4
+
+/* RA4 read by code that takes @cycles in total, see ch-edge.c */
+#define	CH_HAL_SENSOR_SAMPLE(cycles)	PORTAbits.RA4
+
+/* erase or write as set up in PMCON1, stalling the CPU until done */
+#define	CH_HAL_FLASH_START()		do {				\
+						PMCON2 = 0x55;		\
+						PMCON2 = 0xAA;		\
+						PMCON1bits.WR = 1;	\
+						asm("nop");		\
+						asm("nop");		\
+					} while (0)
+
+/* read the word at PMADR into PMDATH:PMDATL */
+#define	CH_HAL_FLASH_READ()		do {				\
+						PMCON1bits.RD = 1;	\
+						asm("nop");		\
+						asm("nop");		\
+					} while (0)
+
+/* anything left pending while disabled is serviced straight away */
+#define	CH_HAL_SET_GIE(gie)		INTCONbits.GIE = (gie)
+
+/* convert the selected ADC channel into ADRESH:ADRESL */
+#define	CH_HAL_ADC_CONVERT()		do {				\
+						ADCON0bits.GO_nDONE = 1;\
+						while (ADCON0bits.GO_nDONE);\
+					} while (0)
+
+#endif
+
+#endif /* __CH_HAL_H */
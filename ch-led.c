@@ -0,0 +1,89 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "ColorHug.h"
+
+#include "ch-common.h"
+#include "ch-led.h"
+
+/* the sequence currently being shown */
+static uint8_t	led_state = 0;
+static uint8_t	led_repeat = 0;
+static uint8_t	led_on_time = 0;
+static uint8_t	led_off_time = 0;
+static uint8_t	led_counter = 0;
+
+/**
+ * CHugLedSetPattern:
+ * @leds: the LED state to show
+ * @repeat: the number of times to flash, 0 for none
+ * @on_time: the time in ms to show @leds
+ * @off_time: the time in ms to show nothing
+ *
+ * Sets the LED state, optionally as a sequence which runs in the
+ * background from CHugLedTick(). A @repeat value of
+ * %CH_LED_REPEAT_FOREVER keeps the sequence going until it is replaced.
+ **/
+void
+CHugLedSetPattern(uint8_t leds, uint8_t repeat,
+		  uint8_t on_time, uint8_t off_time)
+{
+	led_state = leds;
+	led_repeat = repeat;
+	led_on_time = on_time;
+	led_off_time = off_time;
+	led_counter = on_time;
+
+	/* if @repeat is not 0 the sequence starts with the on phase */
+	CHugSetLEDs(leds);
+}
+
+/**
+ * CHugLedTick:
+ *
+ * Advances any running sequence by one millisecond.
+ **/
+void
+CHugLedTick(void)
+{
+	/* no sequence running */
+	if (led_repeat == 0)
+		return;
+
+	/* current phase is not finished */
+	if (led_counter != 0 && --led_counter != 0)
+		return;
+
+	/* end of the on phase */
+	if (CHugGetLEDs() != 0) {
+		CHugSetLEDs(0);
+		led_counter = led_off_time;
+		return;
+	}
+
+	/* end of the off phase, which is where the sequence finishes */
+	if (led_repeat != CH_LED_REPEAT_FOREVER) {
+		if (--led_repeat == 0)
+			return;
+	}
+	CHugSetLEDs(led_state);
+	led_counter = led_on_time;
+}
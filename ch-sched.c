@@ -0,0 +1,131 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "ColorHug.h"
+
+#include "ch-sched.h"
+#include "ch-tick.h"
+
+typedef struct {
+	ChSchedFunc	 func;
+	uint16_t	 remaining;	/* ms */
+	uint16_t	 period;	/* ms, or 0 for one-shot */
+} ChSchedTask;
+
+static ChSchedTask tasks[CH_SCHED_MAX_TASKS];
+
+/**
+ * CHugSchedAdd:
+ * @func: the function to call
+ * @delay: the time in ms before @func is first called
+ * @period: the time in ms between subsequent calls, or 0 for one-shot
+ *
+ * Schedules @func to be called from CHugSchedRun(). If @func is
+ * already scheduled then the existing timer is replaced.
+ **/
+uint8_t
+CHugSchedAdd(ChSchedFunc func, uint16_t delay, uint16_t period)
+{
+	ChSchedTask *task = NULL;
+	uint8_t i;
+
+	/* reuse the existing timer if there is one */
+	for (i = 0; i < CH_SCHED_MAX_TASKS; i++) {
+		if (tasks[i].func == func) {
+			task = &tasks[i];
+			break;
+		}
+		if (task == NULL && tasks[i].func == NULL)
+			task = &tasks[i];
+	}
+	if (task == NULL)
+		return CH_ERROR_OUT_OF_MEMORY;
+
+	/* the soonest we can run is the next tick */
+	if (delay == 0)
+		delay = 1;
+	task->remaining = delay;
+	task->period = period;
+	task->func = func;
+	return CH_ERROR_NONE;
+}
+
+/**
+ * CHugSchedRemove:
+ * @func: the function to stop calling
+ **/
+void
+CHugSchedRemove(ChSchedFunc func)
+{
+	uint8_t i;
+	for (i = 0; i < CH_SCHED_MAX_TASKS; i++) {
+		if (tasks[i].func == func)
+			tasks[i].func = NULL;
+	}
+}
+
+/**
+ * CHugSchedRun:
+ *
+ * Calls any scheduled functions that have expired. This should be
+ * called from the main loop.
+ *
+ * Each function is called at most once, however long the main loop was
+ * blocked, and periodic functions are rescheduled from now rather than
+ * called again for each period that was missed. This means a function
+ * that takes longer than its period cannot stop the main loop from
+ * running.
+ **/
+void
+CHugSchedRun(void)
+{
+	ChSchedFunc func;
+	uint16_t elapsed = 0;
+	uint8_t i;
+
+	/* count the ticks since the last call */
+	while (CHugTickPoll())
+		elapsed++;
+	if (elapsed == 0)
+		return;
+
+	/* find the expired timers first, so that a timer added by one of
+	 * the functions is not called until it has expired too */
+	for (i = 0; i < CH_SCHED_MAX_TASKS; i++) {
+		if (tasks[i].remaining > elapsed)
+			tasks[i].remaining -= elapsed;
+		else
+			tasks[i].remaining = 0;
+	}
+
+	for (i = 0; i < CH_SCHED_MAX_TASKS; i++) {
+		if (tasks[i].func == NULL || tasks[i].remaining != 0)
+			continue;
+
+		/* one-shot timers can reschedule themselves */
+		func = tasks[i].func;
+		if (tasks[i].period == 0)
+			tasks[i].func = NULL;
+		else
+			tasks[i].remaining = tasks[i].period;
+		func();
+	}
+}
@@ -21,28 +21,223 @@
 
 #include "ColorHug.h"
 
+#include <string.h>
+
 #include "ch-common.h"
+#include "ch-edge.h"
 #include "ch-flash.h"
 #include "ch-self-test.h"
+#include "ch-tick.h"
+
+/* each frequency is measured over 50ms, for a resolution of 10Hz */
+#define	CH_SELF_TEST_SAMPLES		40000
+#define	CH_SELF_TEST_HZ_PER_EDGE	(12000000UL / 2 /			\
+					 (CH_EDGE_CYCLES_PER_SAMPLE *		\
+					  CH_SELF_TEST_SAMPLES))
+
+/* the most times a pin is read back before it is a failure */
+#define	CH_SELF_TEST_PIN_RETRIES	16
 
 /**
  * CHugSelfTestSensor:
+ *
+ * Looks at the output for up to 0xffff samples, in blocks so that it
+ * can return as soon as it has seen enough edges.
  **/
 static uint8_t
 CHugSelfTestSensor(uint8_t min_pulses)
 {
-	uint16_t i;
-	uint8_t pulses = 0;
-	uint8_t ra_tmp = PORTA;
+	uint8_t i;
+	uint32_t pulses = 0;
 
 	/* check sensor reports some values */
-	for (i = 0; i < 0xffff && pulses < min_pulses; i++) {
-		if (ra_tmp != PORTA)
-			pulses++;
-	}
+	for (i = 0; i < 16 && pulses < min_pulses; i++)
+		pulses += CHugEdgeCount(0x1000, false);
+	if (pulses > min_pulses)
+		pulses = min_pulses;
 	return pulses;
 }
 
+/**
+ * CHugSelfTestSetMultiplier:
+ *
+ * Returns: the cycles until the multiplier read back as set, or 0xffff
+ **/
+static uint16_t
+CHugSelfTestSetMultiplier(ChFreqScale multiplier)
+{
+	uint16_t start = CHugTickGetCycles();
+	uint8_t i;
+
+	CHugSetMultiplier(multiplier);
+	for (i = 0; i < CH_SELF_TEST_PIN_RETRIES; i++) {
+		if (CHugGetMultiplier() == multiplier)
+			return CHugTickGetCycles() - start;
+	}
+	return 0xffff;
+}
+
+/**
+ * CHugSelfTestSetColorSelect:
+ *
+ * Returns: the cycles until the color select read back as set, or 0xffff
+ **/
+static uint16_t
+CHugSelfTestSetColorSelect(ChColorSelect color_select)
+{
+	uint16_t start = CHugTickGetCycles();
+	uint8_t i;
+
+	CHugSetColorSelect(color_select);
+	for (i = 0; i < CH_SELF_TEST_PIN_RETRIES; i++) {
+		if (CHugGetColorSelect() == color_select)
+			return CHugTickGetCycles() - start;
+	}
+	return 0xffff;
+}
+
+/**
+ * CHugSelfTestPins:
+ * @cycles: the longest time to set the multiplier and color select
+ *
+ * Returns: CH_ERROR_NONE if the pins can be set and read back
+ **/
+static uint8_t
+CHugSelfTestPins(uint16_t *cycles)
+{
+	const uint8_t values[] = { 0, 3, 1, 2 };
+	uint16_t tmp;
+	uint8_t i;
+
+	cycles[0] = 0;
+	cycles[1] = 0;
+	for (i = 0; i < sizeof(values); i++) {
+		tmp = CHugSelfTestSetMultiplier(values[i]);
+		if (tmp == 0xffff)
+			return CH_ERROR_SELF_TEST_MULTIPLIER;
+		if (tmp > cycles[0])
+			cycles[0] = tmp;
+		tmp = CHugSelfTestSetColorSelect(values[i]);
+		if (tmp == 0xffff)
+			return CH_ERROR_SELF_TEST_COLOR_SELECT;
+		if (tmp > cycles[1])
+			cycles[1] = tmp;
+	}
+	return CH_ERROR_NONE;
+}
+
+/**
+ * CHugSelfTestFlashCrc:
+ *
+ * Returns: the CRC-16/CCITT of the firmware image, as read back a word
+ * at a time with the low byte first
+ **/
+static uint16_t
+CHugSelfTestFlashCrc(void)
+{
+	uint8_t data[CH_FLASH_TRANSFER_BLOCK_SIZE];
+	uint16_t addr;
+	uint16_t crc = 0xffff;
+	uint8_t i;
+	uint8_t j;
+
+	for (addr = CH_EEPROM_ADDR_RUNCODE;
+	     addr < CH_EEPROM_ADDR_FAULT_LOG;
+	     addr += CH_FLASH_TRANSFER_BLOCK_SIZE) {
+		CHugFlashRead(addr, CH_FLASH_TRANSFER_BLOCK_SIZE, data);
+		for (i = 0; i < CH_FLASH_TRANSFER_BLOCK_SIZE; i++) {
+			crc ^= (uint16_t) data[i] << 8;
+			for (j = 0; j < 8; j++) {
+				if (crc & 0x8000)
+					crc = (crc << 1) ^ 0x1021;
+				else
+					crc <<= 1;
+			}
+		}
+	}
+	return crc;
+}
+
+/**
+ * CHugSelfTestMeasure:
+ **/
+static uint8_t
+CHugSelfTestMeasure(uint8_t *data)
+{
+	uint16_t cycles[2];
+	uint16_t crc;
+	uint32_t hz;
+	uint32_t hz_max[4];
+	uint8_t color;
+	uint8_t multiplier;
+	uint8_t rc;
+
+	rc = CHugSelfTestPins(cycles);
+	memcpy (&data[48], (const void *) cycles, 4);
+	if (rc != CH_ERROR_NONE)
+		return rc;
+
+	/* each color at 20%, 2% and 100% */
+	for (color = 0; color < 4; color++) {
+		CHugSetColorSelect(color);
+		hz_max[color] = 0;
+		for (multiplier = CH_FREQ_SCALE_20;
+		     multiplier <= CH_FREQ_SCALE_100;
+		     multiplier++) {
+			CHugSetMultiplier(multiplier);
+			hz = CHugEdgeCount(CH_SELF_TEST_SAMPLES, true) *
+			     CH_SELF_TEST_HZ_PER_EDGE;
+			memcpy (&data[(color * 3 + multiplier - 1) * 4],
+				(const void *) &hz,
+				4);
+			if (hz > hz_max[color])
+				hz_max[color] = hz;
+		}
+		CLRWDT();
+	}
+
+	crc = CHugSelfTestFlashCrc();
+	memcpy (&data[52], (const void *) &crc, 2);
+
+	/* are all the results invalid? */
+	if (hz_max[CH_COLOR_SELECT_RED] == 0 &&
+	    hz_max[CH_COLOR_SELECT_GREEN] == 0 &&
+	    hz_max[CH_COLOR_SELECT_BLUE] == 0)
+		return CH_ERROR_SELF_TEST_SENSOR;
+
+	/* one sensor color invalid */
+	if (hz_max[CH_COLOR_SELECT_RED] == 0)
+		return CH_ERROR_SELF_TEST_RED;
+	if (hz_max[CH_COLOR_SELECT_GREEN] == 0)
+		return CH_ERROR_SELF_TEST_GREEN;
+	if (hz_max[CH_COLOR_SELECT_BLUE] == 0)
+		return CH_ERROR_SELF_TEST_BLUE;
+	return CH_ERROR_NONE;
+}
+
+/**
+ * CHugSelfTestReport:
+ * @data: CH_SELF_TEST_REPORT_SIZE bytes for the results
+ *
+ * Measures the output frequency of each color at each multiplier, how
+ * long the sensor pins take to read back and the CRC of the firmware.
+ * The color select is put back as it was, but the multiplier is left
+ * for the caller to restore, as that powers the sensor up or down.
+ *
+ * Returns: the result of the same checks as CHugSelfTest()
+ **/
+uint8_t
+CHugSelfTestReport(uint8_t *data)
+{
+	ChColorSelect color_select_old = CHugGetColorSelect();
+	uint8_t rc;
+
+	memset (data, 0x00, CH_SELF_TEST_REPORT_SIZE);
+	rc = CHugSelfTestMeasure(data);
+	CHugSetColorSelect(color_select_old);
+	return rc;
+}
+
 /**
  * CHugSelfTest:
  **/
@@ -50,23 +245,15 @@ uint8_t
 CHugSelfTest(void)
 {
 	const uint8_t min_pulses = 3;
+	uint16_t cycles[2];
 	uint8_t pulses[3];
+	uint8_t rc;
 
-	/* check multiplier can be set and read */
-	CHugSetMultiplier(CH_FREQ_SCALE_0);
-	if (CHugGetMultiplier() != CH_FREQ_SCALE_0)
-		return CH_ERROR_SELF_TEST_MULTIPLIER;
+	/* check multiplier and color select can be set and read */
+	rc = CHugSelfTestPins(cycles);
+	if (rc != CH_ERROR_NONE)
+		return rc;
 	CHugSetMultiplier(CH_FREQ_SCALE_100);
-	if (CHugGetMultiplier() != CH_FREQ_SCALE_100)
-		return CH_ERROR_SELF_TEST_MULTIPLIER;
-
-	/* check color select can be set and read */
-	CHugSetColorSelect(CH_COLOR_SELECT_RED);
-	if (CHugGetColorSelect() != CH_COLOR_SELECT_RED)
-		return CH_ERROR_SELF_TEST_COLOR_SELECT;
-	CHugSetColorSelect(CH_COLOR_SELECT_GREEN);
-	if (CHugGetColorSelect() != CH_COLOR_SELECT_GREEN)
-		return CH_ERROR_SELF_TEST_COLOR_SELECT;
 
 	/* check red, green and blue */
 	CHugSetColorSelect(CH_COLOR_SELECT_RED);
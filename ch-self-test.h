@@ -24,6 +24,10 @@
 
 #include <stdint.h>
 
+/* the frequencies, pin timings and flash CRC of CHugSelfTestReport() */
+#define	CH_SELF_TEST_REPORT_SIZE		54
+
 uint8_t		 CHugSelfTest		(void);
+uint8_t		 CHugSelfTestReport	(uint8_t	*data);
 
 #endif /* __CH_SELF_TEST_H */
@@ -0,0 +1,248 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Reads the die temperature from the temperature indicator and corrects
+ * readings for it. The indicator can only be read with the ADC, which
+ * the PIC16F1455 and PIC16F1459 have but the PIC16F1454 does not.
+ */
+
+#include "ColorHug.h"
+
+#include <string.h>
+
+#include "ch-flash.h"
+#include "ch-hal.h"
+#include "ch-temp.h"
+#include "ch-tick.h"
+
+#if defined(_16F1455) || defined(_16F1459) || defined(COLORHUG_HOST)
+#define	CH_TEMP_HAS_ADC
+#endif
+
+/* the indicator needs 200us to charge the ADC after being selected */
+#define	CH_TEMP_ACQUISITION_CYCLES	(200 * CH_TICK_CYCLES_PER_US)
+
+/* the FVR buffer has a low impedance and charges the ADC much faster */
+#define	CH_TEMP_FVR_ACQUISITION_CYCLES	(10 * CH_TICK_CYCLES_PER_US)
+
+/* the ADC channels of the temperature indicator and FVR buffer 1 */
+#define	CH_TEMP_ADC_CHANNEL		0b11101
+#define	CH_TEMP_FVR_ADC_CHANNEL		0b11111
+
+/* FVR buffer 1 is set to 1.024V */
+#define	CH_TEMP_FVR_UV			1024000UL
+
+/**
+ * CHugTempInit:
+ *
+ * Turns on the temperature indicator in its high range, which needs at
+ * least 3.6V, and the fixed voltage reference that VDD is measured
+ * against.
+ **/
+void
+CHugTempInit(void)
+{
+#if defined(CH_TEMP_HAS_ADC)
+	FVRCONbits.TSRNG = 1;
+	FVRCONbits.TSEN = 1;
+	FVRCONbits.ADFVR = 0b01;
+	FVRCONbits.FVREN = 1;
+
+	/* right justified, Fosc/64 and VDD as the reference */
+	ADCON1bits.ADFM = 1;
+	ADCON1bits.ADCS = 0b110;
+	ADCON1bits.ADPREF = 0b00;
+	ADCON0bits.ADON = 1;
+#endif
+}
+
+/**
+ * CHugTempRead:
+ * @temperature: the die temperature in 1/100 degrees C
+ *
+ * In the high range the indicator gives VDD - 4Vt, where Vt falls from
+ * 0.659V at -40C by 1.32mV for each degree.
+ *
+ * The ADC uses VDD as its reference, and the USB bus supply can be
+ * anywhere from 4.4V to 5.25V, so VDD is measured against the fixed
+ * voltage reference first. The tolerance of the reference then only
+ * gives a fixed offset, which is why this is only accurate to a few
+ * degrees.
+ **/
+uint8_t
+CHugTempRead(int16_t *temperature)
+{
+#if defined(CH_TEMP_HAS_ADC)
+	int32_t vt;
+	uint32_t vdd;
+	uint16_t adc;
+
+	/* in uV */
+	ADCON0bits.CHS = CH_TEMP_FVR_ADC_CHANNEL;
+	_delay(CH_TEMP_FVR_ACQUISITION_CYCLES);
+	CH_HAL_ADC_CONVERT();
+	adc = ((uint16_t) ADRESH << 8) | ADRESL;
+	if (adc == 0) {
+		*temperature = CH_TEMPERATURE_UNKNOWN;
+		return CH_ERROR_UNDERFLOW_SENSOR;
+	}
+	vdd = CH_TEMP_FVR_UV * 1023 / adc;
+
+	ADCON0bits.CHS = CH_TEMP_ADC_CHANNEL;
+	_delay(CH_TEMP_ACQUISITION_CYCLES);
+	CH_HAL_ADC_CONVERT();
+	adc = ((uint16_t) ADRESH << 8) | ADRESL;
+	vt = (vdd - (uint32_t) adc * (vdd / 1023)) / 4;
+	*temperature = (659000L - vt) * 100 / 1320 - 4000;
+	return CH_ERROR_NONE;
+#else
+	*temperature = CH_TEMPERATURE_UNKNOWN;
+	return CH_ERROR_NOT_IMPLEMENTED;
+#endif
+}
+
+/**
+ * CHugTempGetValue:
+ *
+ * Returns: the value at @idx in the coefficients block, with the 14 bits
+ * kept in flash sign-extended to 16
+ **/
+static int16_t
+CHugTempGetValue(const uint8_t *data, uint8_t idx)
+{
+	uint16_t value;
+
+	memcpy (&value, &data[idx * 2], 2);
+	if (value & 0x2000)
+		value |= 0xc000;
+	return value;
+}
+
+/**
+ * CHugTempGetCoefficients:
+ * @data: CH_TEMP_COEFFICIENTS_SIZE bytes
+ **/
+uint8_t
+CHugTempGetCoefficients(uint8_t *data)
+{
+	int16_t value;
+	uint8_t i;
+	uint8_t rc;
+
+	rc = CHugFlashRead(CH_EEPROM_ADDR_TEMP_COEFFICIENTS,
+			   CH_TEMP_COEFFICIENTS_SIZE,
+			   data);
+	if (rc != CH_ERROR_NONE)
+		return rc;
+	for (i = 0; i < CH_TEMP_COEFFICIENTS_SIZE / 2; i++) {
+		value = CHugTempGetValue(data, i);
+		memcpy (&data[i * 2], (const void *) &value, 2);
+	}
+
+	/* never set */
+	if (CHugTempGetValue(data, 4) == -1) {
+		memset (data, 0x00, CH_TEMP_COEFFICIENTS_SIZE);
+		value = CH_TEMPERATURE_UNKNOWN;
+		memcpy (&data[8], (const void *) &value, 2);
+	}
+	return CH_ERROR_NONE;
+}
+
+/**
+ * CHugTempSetCoefficients:
+ * @data: CH_TEMP_COEFFICIENTS_SIZE bytes
+ *
+ * Without an ADC the readings can never be compensated, so nothing is
+ * written to flash.
+ **/
+uint8_t
+CHugTempSetCoefficients(const uint8_t *data)
+{
+#if defined(CH_TEMP_HAS_ADC)
+	int16_t value;
+	uint8_t tmp[CH_TEMP_COEFFICIENTS_SIZE];
+	uint8_t i;
+
+	for (i = 0; i < CH_TEMP_COEFFICIENTS_SIZE / 2; i++) {
+		memcpy (&value, &data[i * 2], 2);
+		if (i == 4 && value == CH_TEMPERATURE_UNKNOWN)
+			value = -1;
+		else if (value > CH_TEMP_COEFFICIENT_MAX ||
+			 value < -CH_TEMP_COEFFICIENT_MAX)
+			return CH_ERROR_INVALID_VALUE;
+		value &= 0x3fff;
+		memcpy (&tmp[i * 2], (const void *) &value, 2);
+	}
+	return CHugFlashUpdate(CH_EEPROM_ADDR_TEMP_COEFFICIENTS,
+			       CH_TEMP_COEFFICIENTS_SIZE,
+			       tmp);
+#else
+	return CH_ERROR_NOT_IMPLEMENTED;
+#endif
+}
+
+/**
+ * CHugTempCompensate:
+ * @count: the count to correct
+ * @color_select: the color @count was taken with
+ * @temperature: the die temperature when it was taken
+ *
+ * Corrects @count to the reference temperature, to first order.
+ *
+ * Returns: CH_ERROR_NO_CALIBRATION if there are no coefficients
+ **/
+uint8_t
+CHugTempCompensate(uint32_t *count, uint8_t color_select, int16_t temperature)
+{
+	int16_t coefficient;
+	int16_t reference;
+	int32_t ppm;
+	int32_t error;
+	uint8_t data[CH_TEMP_COEFFICIENTS_SIZE];
+	uint8_t rc;
+
+	if (temperature == CH_TEMPERATURE_UNKNOWN)
+		return CH_ERROR_NO_CALIBRATION;
+	rc = CHugTempGetCoefficients(data);
+	if (rc != CH_ERROR_NONE)
+		return rc;
+	memcpy (&reference, &data[8], 2);
+	if (reference == CH_TEMPERATURE_UNKNOWN)
+		return CH_ERROR_NO_CALIBRATION;
+	memcpy (&coefficient, &data[color_select * 2], 2);
+
+	/* the change from the reference, limited to 100% */
+	ppm = (int32_t) coefficient * (temperature - reference) / 100;
+	if (ppm > 1000000L)
+		ppm = 1000000L;
+	if (ppm < -1000000L)
+		ppm = -1000000L;
+
+	/* split to keep within 32 bits */
+	error = (int32_t) (*count / 1000) * ppm / 1000 +
+		(int32_t) (*count % 1000) * ppm / 1000000L;
+	if (error > 0 && (uint32_t) error > *count)
+		*count = 0;
+	else
+		*count -= error;
+	return CH_ERROR_NONE;
+}
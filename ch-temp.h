@@ -0,0 +1,35 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __CH_TEMP_H
+#define __CH_TEMP_H
+
+#include <stdint.h>
+
+void		 CHugTempInit		(void);
+uint8_t		 CHugTempRead		(int16_t	*temperature);
+uint8_t		 CHugTempGetCoefficients (uint8_t	*data);
+uint8_t		 CHugTempSetCoefficients (const uint8_t	*data);
+uint8_t		 CHugTempCompensate	(uint32_t	*count,
+					 uint8_t	 color_select,
+					 int16_t	 temperature);
+
+#endif /* __CH_TEMP_H */
@@ -0,0 +1,170 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "ColorHug.h"
+
+#include "ch-tick.h"
+
+/* ticks counted by CHugTickInterrupt() but not yet returned */
+static volatile uint16_t tick_pending = 0;
+
+/* the upper half of the cycle counter */
+static volatile uint16_t cycles_wraps = 0;
+
+/**
+ * CHugTickInit:
+ *
+ * Sets up Timer2 to expire once every millisecond, and Timer1 to count
+ * instruction cycles.
+ **/
+void
+CHugTickInit(void)
+{
+	/* free-running from the 12MHz instruction clock */
+	T1CONbits.TMR1CS = 0b00;
+	T1CONbits.T1CKPS = 0b00;
+	T1CONbits.TMR1ON = 1;
+
+	/* 12MHz instruction clock / 16 prescaler / 250 period / 3 postscaler */
+	T2CONbits.T2CKPS = 0b10;
+	T2CONbits.T2OUTPS = 0b0010;
+	PR2 = 249;
+	TMR2 = 0;
+	PIR1bits.TMR2IF = 0;
+	T2CONbits.TMR2ON = 1;
+}
+
+/**
+ * CHugTickGetCycles:
+ *
+ * Returns: the number of instruction cycles, which wraps every 5.4ms
+ **/
+uint16_t
+CHugTickGetCycles(void)
+{
+	uint8_t high;
+	uint8_t low;
+
+	/* the two halves cannot be read at the same time */
+	do {
+		high = TMR1H;
+		low = TMR1L;
+	} while (high != TMR1H);
+	return ((uint16_t) high << 8) | low;
+}
+
+/**
+ * CHugTickCheckWrap:
+ *
+ * Counts Timer1 overflows when the ISR is not doing it.
+ **/
+static void
+CHugTickCheckWrap(void)
+{
+	if (PIE1bits.TMR1IE || !PIR1bits.TMR1IF)
+		return;
+	PIR1bits.TMR1IF = 0;
+	cycles_wraps++;
+}
+
+/**
+ * CHugTickGetCycles32:
+ *
+ * Without CHugTickEnableInterrupt() this is only correct if it or
+ * CHugTickPoll() is called at least every 5.4ms.
+ *
+ * Returns: the number of instruction cycles, which wraps every 358s
+ **/
+uint32_t
+CHugTickGetCycles32(void)
+{
+	uint16_t wraps;
+	uint16_t low;
+
+	/* retry if the counter overflowed while reading it */
+	do {
+		CHugTickCheckWrap();
+		wraps = cycles_wraps;
+		low = CHugTickGetCycles();
+		CHugTickCheckWrap();
+	} while (wraps != cycles_wraps);
+	return ((uint32_t) wraps << 16) | low;
+}
+
+/**
+ * CHugTickEnableInterrupt:
+ *
+ * Counts the tick from the ISR so that no ticks are lost when the main
+ * loop is blocked, for instance when taking a reading.
+ **/
+void
+CHugTickEnableInterrupt(void)
+{
+	PIR1bits.TMR1IF = 0;
+	PIE1bits.TMR1IE = 1;
+	PIR1bits.TMR2IF = 0;
+	PIE1bits.TMR2IE = 1;
+	INTCONbits.PEIE = 1;
+}
+
+/**
+ * CHugTickInterrupt:
+ *
+ * This should be called from the ISR.
+ **/
+void
+CHugTickInterrupt(void)
+{
+	if (PIE1bits.TMR1IE && PIR1bits.TMR1IF) {
+		PIR1bits.TMR1IF = 0;
+		cycles_wraps++;
+	}
+	if (!PIE1bits.TMR2IE || !PIR1bits.TMR2IF)
+		return;
+	PIR1bits.TMR2IF = 0;
+	tick_pending++;
+}
+
+/**
+ * CHugTickPoll:
+ *
+ * Returns: %true if a millisecond has passed since the last call,
+ * which should be called again until it returns %false
+ **/
+bool
+CHugTickPoll(void)
+{
+	/* ticks counted in the ISR */
+	if (PIE1bits.TMR2IE) {
+		if (tick_pending == 0)
+			return false;
+		PIE1bits.TMR2IE = 0;
+		tick_pending--;
+		PIE1bits.TMR2IE = 1;
+		return true;
+	}
+
+	CHugTickCheckWrap();
+	if (!PIR1bits.TMR2IF)
+		return false;
+	PIR1bits.TMR2IF = 0;
+	return true;
+}
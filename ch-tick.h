@@ -0,0 +1,39 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __CH_TICK_H
+#define __CH_TICK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* the instruction clock, which is what Timer1 counts */
+#define	CH_TICK_CYCLES_PER_US			12
+#define	CH_TICK_CYCLES_PER_MS			12000UL
+
+void		 CHugTickInit		(void);
+uint16_t	 CHugTickGetCycles	(void);
+uint32_t	 CHugTickGetCycles32	(void);
+void		 CHugTickEnableInterrupt	(void);
+void		 CHugTickInterrupt	(void);
+bool		 CHugTickPoll		(void);
+
+#endif /* __CH_TICK_H */
@@ -0,0 +1,97 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "ColorHug.h"
+
+#include <string.h>
+
+#include "ch-trace.h"
+
+typedef struct {
+	uint8_t		 cmd;
+	uint8_t		 rc;
+	uint32_t	 start;		/* cycles */
+	uint32_t	 duration;	/* cycles */
+} ChTraceEntry;
+
+static ChTraceEntry	entries[CH_TRACE_SIZE];
+static uint8_t		entries_head = 0;
+static uint8_t		entries_len = 0;
+
+/**
+ * CHugTraceAdd:
+ * @cmd: the command, including any flags
+ * @rc: the return code sent to the host
+ * @start: the time the command was started, from CHugTickGetCycles32()
+ * @duration: the number of cycles spent handling the command
+ *
+ * Records a handled command, replacing the oldest if the trace is full.
+ **/
+void
+CHugTraceAdd(uint8_t cmd, uint8_t rc, uint32_t start, uint32_t duration)
+{
+	ChTraceEntry *entry = &entries[entries_head];
+
+	entry->cmd = cmd;
+	entry->rc = rc;
+	entry->start = start;
+	entry->duration = duration;
+	entries_head = (entries_head + 1) & (CH_TRACE_SIZE - 1);
+	if (entries_len < CH_TRACE_SIZE)
+		entries_len++;
+}
+
+/**
+ * CHugTraceGetChunk:
+ * @chunk: the chunk number, where chunk 0 has the oldest entries
+ * @data: the buffer to write [1:entries] and then the entries to
+ *
+ * Returns: CH_ERROR_INVALID_VALUE if there are no entries in @chunk
+ **/
+uint8_t
+CHugTraceGetChunk(uint8_t chunk, uint8_t *data)
+{
+	uint8_t i;
+	uint8_t idx;
+	uint8_t len;
+	uint8_t offset;
+
+	/* chunk 0 is always valid, even if empty */
+	if (chunk > CH_TRACE_SIZE / CH_TRACE_CHUNK_SIZE)
+		return CH_ERROR_INVALID_VALUE;
+	offset = chunk * CH_TRACE_CHUNK_SIZE;
+	if (chunk > 0 && offset >= entries_len)
+		return CH_ERROR_INVALID_VALUE;
+
+	len = entries_len - offset;
+	if (len > CH_TRACE_CHUNK_SIZE)
+		len = CH_TRACE_CHUNK_SIZE;
+	*data++ = len;
+	for (i = 0; i < len; i++) {
+		idx = (entries_head - entries_len + offset + i) & (CH_TRACE_SIZE - 1);
+		data[0] = entries[idx].cmd;
+		data[1] = entries[idx].rc;
+		memcpy (&data[2], (const void *) &entries[idx].start, 4);
+		memcpy (&data[6], (const void *) &entries[idx].duration, 4);
+		data += 10;
+	}
+	return CH_ERROR_NONE;
+}
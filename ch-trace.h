@@ -0,0 +1,40 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __CH_TRACE_H
+#define __CH_TRACE_H
+
+#include <stdint.h>
+
+/* the number of commands that are remembered, which must be a power of 2 */
+#define	CH_TRACE_SIZE				8
+
+/* the number of entries returned by each CH_CMD_GET_TRACE */
+#define	CH_TRACE_CHUNK_SIZE			6
+
+void		 CHugTraceAdd		(uint8_t	 cmd,
+					 uint8_t	 rc,
+					 uint32_t	 start,
+					 uint32_t	 duration);
+uint8_t		 CHugTraceGetChunk	(uint8_t	 chunk,
+					 uint8_t	*data);
+
+#endif /* __CH_TRACE_H */
@@ -28,7 +28,15 @@
 #include "HardwareProfile.h"
 #include "usb_config.h"
 #include "ch-common.h"
+#include "ch-edge.h"
 #include "ch-flash.h"
+#include "ch-hal.h"
+#include "ch-led.h"
+#include "ch-sched.h"
+#include "ch-self-test.h"
+#include "ch-temp.h"
+#include "ch-tick.h"
+#include "ch-trace.h"
 
 #include <delays.h>
 #include <USB/usb.h>
@@ -42,224 +50,1595 @@
 void interrupt
 ISRCode(void)
 {
+	/* keep counting time even when the main loop is busy */
+	CHugTickInterrupt();
+
+#if defined(USB_INTERRUPT)
+	/* service the bus even when a reading is in progress */
+	USBDeviceTasks();
+#endif
+}
+
+static uint16_t		SensorIntegralTime = 0xffff;
+static ChEdgeMode	SensorEdgeMode = CH_EDGE_MODE_RISING;
+static bool		SensorDarkSubtract = false;
+static ChFreqScale	SensorMultiplier = CH_FREQ_SCALE_100;
+static uint16_t		SensorPowerTimeout = CH_SENSOR_POWER_TIMEOUT_DEFAULT;
+static ChFreqScale	multiplier_old = CH_FREQ_SCALE_0;
+
+/* the TCS3200 output is valid 100us after it is powered up, but the
+ * first pulse may still be too long or short and so is not counted */
+#define	CH_SENSOR_WARMUP_CYCLES	(100 * CH_TICK_CYCLES_PER_US)
+static uint32_t		sensor_power_start = 0;
+static uint32_t		sensor_used = 0;
+static bool		sensor_settled = false;
+static bool		sensor_seen_low = false;
+static volatile bool	sensor_resume = false;
+
+/* readings outside the range wake the host from suspend, see
+ * CH_CMD_SET_WAKE_THRESHOLD */
+typedef struct {
+	uint32_t	 low;
+	uint32_t	 high;
+	uint16_t	 integral_time;
+} ChWakeThreshold;
+
+static ChWakeThreshold	wake_threshold = { 0, 0, 0 };
+static bool		wake_slept = false;
+
+/* the watchdog wakes the device about once a second to take a reading */
+#define	CH_WAKE_WDTPS		0b01010
+
+/* resume signalling must be driven for 1 to 15ms */
+#define	CH_WAKE_RESUME_DELAY	3	/* x 10k cycles */
+
+/* a sequence of readings uploaded by the host, see CH_CMD_SET_PROGRAM */
+typedef struct {
+	uint8_t		 color_select;
+	uint8_t		 multiplier;
+	uint16_t	 integral_time;
+} ChProgramStep;
+
+static ChProgramStep	program_steps[CH_PROGRAM_STEPS_MAX];
+static uint8_t		program_len = 0;
+static uint16_t		program_repeat = 0;
+static uint16_t		program_interval = 0;
+static uint8_t		program_step = 0;
+static uint16_t		program_pass = 0;
+static uint8_t		program_state = 0;
+static uint8_t		program_color_old;
+static ChFreqScale	program_multiplier_old;
+
+/* results waiting for the host, oldest first */
+static uint32_t		program_results[CH_PROGRAM_RESULTS_MAX];
+static uint8_t		program_results_head = 0;
+static uint8_t		program_results_len = 0;
+
+/* the USB frame and the time since its SOF */
+typedef struct {
+	uint16_t	 frame;
+	uint16_t	 offset;	/* us */
+} ChTimestamp;
+
+/* latched at each SOF to give readings a sub-frame offset */
+static volatile uint16_t sof_cycles = 0;
+static volatile uint16_t sof_frame = 0;
+static ChTimestamp	reading_start;
+static ChTimestamp	reading_end;
+static uint8_t		reading_flags;
+static uint32_t		reading_corrected;
+static int16_t		reading_temperature;
+
+/* a reading armed to start at a host-specified frame */
+typedef enum {
+	CH_ARM_STATE_IDLE,
+	CH_ARM_STATE_WAITING,
+	CH_ARM_STATE_TRIGGERED,
+	CH_ARM_STATE_DONE
+} ChArmState;
+
+static volatile uint8_t	arm_state = CH_ARM_STATE_IDLE;
+static uint16_t		arm_frame = 0;
+static uint32_t		arm_reading;
+static ChTimestamp	arm_start;
+static ChTimestamp	arm_end;
+static uint8_t		arm_flags;
+static uint32_t		arm_corrected;
+static int16_t		arm_temperature;
+
+/* this is used to map the firmware to a hardware version */
+static const char flash_id[] = CH_FIRMWARE_ID_TOKEN;
+
+/* USB idle support */
+static uint8_t		idle_command = 0x00;
+
+/* USB buffers: requests are received straight into a ring of queue
+ * slots, which are used in order as pending, armed and then free, and
+ * there is a reply buffer for each side of the ping-pong IN endpoint */
+#define	CH_CMD_QUEUE_SIZE	2	/* must be a power of 2 */
+static uint8_t RxBuffer[CH_CMD_QUEUE_SIZE][CH_USB_HID_EP_SIZE];
+static uint8_t TxBuffer[2][CH_USB_HID_EP_SIZE];
+USB_HANDLE		USBOutHandle[CH_CMD_QUEUE_SIZE];
+USB_HANDLE		USBInHandle[2] = { 0, 0 };
+static uint8_t		rx_head = 0;
+static uint8_t		rx_pending = 0;
+static uint8_t		rx_armed = 0;
+static volatile bool	rx_reset = false;
+static uint8_t		tx_idx = 0;
+
+/* instruction cycles spent handling the last command */
+static uint32_t		process_cycles = 0;
+
+/* performance counters, in the order sent by CH_CMD_GET_STATS */
+typedef struct {
+	uint32_t	 process_io;
+	uint32_t	 readings;
+	uint16_t	 incomplete;
+	uint16_t	 edge_overflows;
+	uint32_t	 loop_max;	/* cycles */
+	uint16_t	 suspends;
+	uint16_t	 resumes;
+	uint16_t	 watchdog_near_misses;
+	uint16_t	 power_ups;
+	uint16_t	 sleeps;
+	uint16_t	 remote_wakeups;
+} ChStats;
+
+/* the default 1:65536 watchdog prescaler times out after 2s */
+#define	CH_STATS_WATCHDOG_NEAR_MISS	(1000000UL * CH_TICK_CYCLES_PER_US)
+
+/* the commands counted by CH_CMD_GET_STATS, with unknown ones last */
+static const uint8_t stats_cmds[] = {
+	CH_CMD_GET_COLOR_SELECT,
+	CH_CMD_SET_COLOR_SELECT,
+	CH_CMD_GET_MULTIPLIER,
+	CH_CMD_SET_MULTIPLIER,
+	CH_CMD_GET_INTEGRAL_TIME,
+	CH_CMD_SET_INTEGRAL_TIME,
+	CH_CMD_GET_FIRMWARE_VERSION,
+	CH_CMD_GET_SERIAL_NUMBER,
+	CH_CMD_GET_LEDS,
+	CH_CMD_SET_LEDS,
+	CH_CMD_TAKE_READING_RAW,
+	CH_CMD_RESET,
+	CH_CMD_SET_FLASH_SUCCESS,
+	CH_CMD_GET_HARDWARE_VERSION,
+	CH_CMD_SELF_TEST,
+	CH_CMD_SET_STREAM,
+	CH_CMD_ARM_READING,
+	CH_CMD_GET_ARMED_READING,
+	CH_CMD_PING,
+	CH_CMD_GET_STATS,
+	CH_CMD_GET_TRACE,
+	CH_CMD_GET_FAULT_LOG,
+	CH_CMD_CLEAR_FAULT_LOG,
+	CH_CMD_GET_EDGE_MODE,
+	CH_CMD_SET_EDGE_MODE,
+	CH_CMD_TAKE_DARK_CALIBRATION,
+	CH_CMD_GET_DARK_OFFSETS,
+	CH_CMD_GET_DARK_SUBTRACT,
+	CH_CMD_SET_DARK_SUBTRACT,
+	CH_CMD_GET_TEMPERATURE,
+	CH_CMD_GET_TEMP_COEFFICIENTS,
+	CH_CMD_SET_TEMP_COEFFICIENTS,
+	CH_CMD_GET_POWER_TIMEOUT,
+	CH_CMD_SET_POWER_TIMEOUT,
+	CH_CMD_GET_WAKE_THRESHOLD,
+	CH_CMD_SET_WAKE_THRESHOLD,
+	CH_CMD_SET_PROGRAM,
+	CH_CMD_RUN_PROGRAM,
+	CH_CMD_GET_PROGRAM_RESULTS,
+	0x00
+};
+#define	CH_STATS_CMDS_MAX	sizeof(stats_cmds)
+#define	CH_STATS_CMDS_PER_PAGE	30
+
+static ChStats		stats;
+static uint32_t		loop_start = 0;
+static uint8_t		stats_cmd_count[CH_STATS_CMDS_MAX];
+
+/* samples sent on the stream or vendor interface */
+static uint8_t StreamBuffer[CH_USB_HID_STREAM_EP_SIZE];
+USB_HANDLE		USBStreamHandle = 0;
+static uint16_t		stream_sample = 0;
+static uint16_t		stream_interval = 0;
+static bool		stream_running = false;
+static uint8_t		stream_ep = HID_STREAM_EP;
+
+/* request and then reply for the feature report */
+static uint8_t FeatureBuffer[CH_USB_HID_EP_SIZE];
+static volatile bool	feature_set_pending = false;
+static volatile bool	feature_get_pending = false;
+
+/* the stream interface is not handled by USBCheckHIDRequest() */
+extern ROM struct { BYTE report[HID_RPT02_SIZE]; } hid_rpt02;
+
+/**
+ * CHugGetTimestamp:
+ *
+ * The offset is only accurate to a few microseconds when USB_INTERRUPT
+ * is used, as otherwise the SOF is only seen when the bus is polled.
+ * Frames are exactly 1ms, so if the last SOF that was seen is from an
+ * earlier frame then the time of the missing SOFs is taken off.
+ **/
+static void
+CHugGetTimestamp(ChTimestamp *ts)
+{
+	uint16_t cycles;
+	uint16_t frames;
+
+	/* retry if the frame changed while reading the SOF time */
+	do {
+		ts->frame = ((uint16_t) UFRMH << 8) | UFRML;
+		cycles = CHugTickGetCycles() - sof_cycles;
+		frames = (ts->frame - sof_frame) & CH_USB_FRAME_MASK;
+	} while (ts->frame != (((uint16_t) UFRMH << 8) | UFRML));
+
+	/* Timer1 wraps every 5.4ms, but the offset is less than a frame so
+	 * the missing frames can be taken off modulo the Timer1 period */
+	cycles -= frames * (uint16_t) CH_TICK_CYCLES_PER_MS;
+
+	/* the device clock is slightly slower than the host */
+	if ((int16_t) cycles < 0)
+		cycles = 0;
+	ts->offset = cycles / CH_TICK_CYCLES_PER_US;
+}
+
+/**
+ * CHugFrameReached:
+ *
+ * Frame numbers are 11 bits and wrap every 2.048s, so any frame in the
+ * 1.024s up to @now counts as having been reached.
+ **/
+static bool
+CHugFrameReached(uint16_t now, uint16_t frame)
+{
+	return ((now - frame) & CH_USB_FRAME_MASK) < CH_USB_FRAME_HALF;
+}
+
+/**
+ * CHugArmPending:
+ *
+ * Returns: %true if a reading is armed and has not been taken yet, in
+ * which case nothing may block the main loop until its frame
+ **/
+static bool
+CHugArmPending(void)
+{
+	return arm_state == CH_ARM_STATE_WAITING ||
+	       arm_state == CH_ARM_STATE_TRIGGERED;
+}
+
+/**
+ * CHugDarkGetOffset:
+ *
+ * Returns: the dark offset for the color and multiplier, or 0 if the
+ * dark calibration has not been done
+ **/
+static uint16_t
+CHugDarkGetOffset(uint8_t color, uint8_t multiplier)
+{
+	uint16_t offset = CH_DARK_OFFSET_NONE;
+
+	CHugFlashRead(CH_EEPROM_ADDR_DARK_OFFSETS + (multiplier * 4 + color) * 2,
+		      2, (uint8_t *) &offset);
+	if (offset == CH_DARK_OFFSET_NONE)
+		return 0;
+	return offset;
+}
+
+/**
+ * CHugDarkSubtract:
+ *
+ * Returns: @count less the dark count for the current color, multiplier,
+ * edge mode and @integral_time, rounded to the nearest edge
+ **/
+static uint32_t
+CHugDarkSubtract(uint32_t count, uint16_t integral_time)
+{
+	uint32_t dark;
+
+	dark = CHugDarkGetOffset(CHugGetColorSelect(), CHugGetMultiplier());
+	dark *= integral_time;
+	dark += 1UL << (CH_DARK_OFFSET_SHIFT - 1);
+	dark >>= CH_DARK_OFFSET_SHIFT;
+	if (SensorEdgeMode == CH_EDGE_MODE_BOTH)
+		dark *= 2;
+	if (count < dark)
+		return 0;
+	return count - dark;
+}
+
+/**
+ * CHugSensorIdle:
+ *
+ * Powers the sensor down when no reading has been taken for
+ * SensorPowerTimeout.
+ *
+ * The scheduler counts the ticks that passed during a reading after the
+ * timer has been restarted, so the time is checked again here.
+ **/
+static void
+CHugSensorIdle(void)
+{
+	uint32_t elapsed;
+
+	elapsed = (CHugTickGetCycles32() - sensor_used) / CH_TICK_CYCLES_PER_MS;
+	if (elapsed < SensorPowerTimeout) {
+		CHugSchedAdd(CHugSensorIdle, SensorPowerTimeout - elapsed, 0);
+		return;
+	}
+	CHugSetMultiplier(CH_FREQ_SCALE_0);
+}
+
+/**
+ * CHugSensorStartIdle:
+ *
+ * Restarts the time the sensor is left powered for without a reading.
+ **/
+static void
+CHugSensorStartIdle(void)
+{
+	if (SensorPowerTimeout == 0 ||
+	    CHugGetMultiplier() == CH_FREQ_SCALE_0) {
+		CHugSchedRemove(CHugSensorIdle);
+		return;
+	}
+	sensor_used = CHugTickGetCycles32();
+	CHugSchedAdd(CHugSensorIdle, SensorPowerTimeout, 0);
+}
+
+/**
+ * CHugSensorSetMultiplier:
+ * @multiplier: a #ChFreqScale
+ *
+ * Powers the sensor up at @multiplier, which is then used for readings
+ * taken when it is powered up on demand. CH_FREQ_SCALE_0 powers the
+ * sensor down until the next reading.
+ **/
+static void
+CHugSensorSetMultiplier(ChFreqScale multiplier)
+{
+	if (multiplier == CH_FREQ_SCALE_0) {
+		CHugSetMultiplier(CH_FREQ_SCALE_0);
+		CHugSchedRemove(CHugSensorIdle);
+		return;
+	}
+	SensorMultiplier = multiplier;
+	if (CHugGetMultiplier() == CH_FREQ_SCALE_0) {
+		sensor_power_start = CHugTickGetCycles32();
+		sensor_settled = false;
+		sensor_seen_low = false;
+		stats.power_ups++;
+	}
+	CHugSetMultiplier(multiplier);
+	CHugSensorStartIdle();
+}
+
+/**
+ * CHugSensorPowerUp:
+ * @integral_time: the longest time to wait for a pulse
+ *
+ * Powers the sensor up if it is off, and then waits until it has been
+ * on for CH_SENSOR_WARMUP_CYCLES and the first pulse has been skipped.
+ **/
+static void
+CHugSensorPowerUp(uint16_t integral_time)
+{
+	uint32_t elapsed;
+
+	if (CHugGetMultiplier() == CH_FREQ_SCALE_0)
+		CHugSensorSetMultiplier(SensorMultiplier);
+	if (sensor_settled)
+		return;
+
+	/* sampling takes a fixed time, so use it to wait out the warm-up */
+	elapsed = CHugTickGetCycles32() - sensor_power_start;
+	if (elapsed < CH_SENSOR_WARMUP_CYCLES) {
+		CHugEdgeCount((CH_SENSOR_WARMUP_CYCLES - elapsed) /
+			      CH_EDGE_CYCLES_PER_SAMPLE, false);
+	}
+	CHugEdgeWaitRising(integral_time);
+	sensor_settled = true;
+}
+
+/**
+ * CHugTakeReadingRaw:
+ *
+ * The USB frame number and sub-frame offset are latched in
+ * reading_start and reading_end when the integration starts and ends,
+ * and reading_flags says which edges were counted. The count less the
+ * dark offset is put in reading_corrected when SensorDarkSubtract is set,
+ * and corrected to the reference temperature if that has been set. The
+ * die temperature at the end is put in reading_temperature.
+ *
+ * Each unit of @integral_time is CH_EDGE_SAMPLES_PER_INTEGRAL_TIME
+ * samples of 1.25us, and outputs up to CH_EDGE_MAX_FREQUENCY are counted.
+ * When USB_INTERRUPT is used the integration window is stretched by
+ * the time spent in the ISR, and edges shorter than the ISR may be
+ * missed.
+ *
+ * The TAOS3200 sensor with the external IR filter gives the following rough
+ * outputs with red selected at 100%:
+ *
+ *   Frequency   |   Condition
+ * --------------|-------------------
+ *    10Hz       | Aperture covered
+ *    160Hz      | TFT backlight on, but masked to black
+ *    1.24KHz    | 100 white at 170cd/m2
+ **/
+static uint32_t
+CHugTakeReadingRaw (uint16_t integral_time)
+{
+	const uint8_t abs_scale[] = {  5, 5, 7, 6 }; /* red, white, blue, green */
+	uint32_t number_edges;
+	uint32_t value;
+	uint8_t color;
+
+	reading_flags = 0;
+	if (SensorEdgeMode == CH_EDGE_MODE_BOTH)
+		reading_flags |= CH_READING_FLAG_BOTH_EDGES;
+	if (SensorDarkSubtract)
+		reading_flags |= CH_READING_FLAG_DARK_SUBTRACTED;
+	reading_corrected = 0;
+	reading_temperature = CH_TEMPERATURE_UNKNOWN;
+
+	/* wait for the output to change so we start on a new pulse
+	 * rising edge, which means more accurate black readings
+	 * ___      ____
+	 *    |____|    |___
+	 *
+	 *         ^- START HERE
+	 */
+	if (!CHugEdgeWaitRising(integral_time)) {
+		CHugGetTimestamp(&reading_start);
+		reading_end = reading_start;
+		return 0;
+	}
+
+	/* count how many times we get a rising edge, or any edge */
+	CHugGetTimestamp(&reading_start);
+	stats.readings++;
+	number_edges = CHugEdgeCount((uint32_t) integral_time *
+				     CH_EDGE_SAMPLES_PER_INTEGRAL_TIME,
+				     SensorEdgeMode == CH_EDGE_MODE_BOTH);
+	CHugGetTimestamp(&reading_end);
+	CHugTempRead(&reading_temperature);
+
+	/* scale it according to the datasheet */
+	color = CHugGetColorSelect();
+	value = number_edges * abs_scale[color];
+
+	/* overflow */
+	if (value < number_edges) {
+		stats.edge_overflows++;
+		reading_corrected = UINT32_MAX;
+		return UINT32_MAX;
+	}
+
+	reading_corrected = number_edges;
+	if (SensorDarkSubtract)
+		reading_corrected = CHugDarkSubtract(number_edges, integral_time);
+	if (CHugTempCompensate(&reading_corrected, color,
+			       reading_temperature) == CH_ERROR_NONE)
+		reading_flags |= CH_READING_FLAG_TEMP_COMPENSATED;
+	return number_edges;
+}
+
+/**
+ * CHugTakeReading:
+ *
+ * Takes a reading as for CHugTakeReadingRaw(), powering the sensor up
+ * first if needed and then restarting the idle timeout.
+ **/
+static uint32_t
+CHugTakeReading(uint16_t integral_time)
+{
+	uint32_t reading;
+
+	CHugSensorPowerUp(integral_time);
+	reading = CHugTakeReadingRaw(integral_time);
+	CHugSensorStartIdle();
+	return reading;
+}
+
+/**
+ * CHugReadingTime:
+ * @integral_time: the integral time of the reading
+ *
+ * Returns: the most time a reading can block the main loop, in ms,
+ * counting the wait for a rising edge as one more sample per step
+ **/
+static uint16_t
+CHugReadingTime(uint16_t integral_time)
+{
+	uint32_t cycles;
+
+	cycles = (uint32_t) integral_time *
+		 (CH_EDGE_SAMPLES_PER_INTEGRAL_TIME + 1) *
+		 CH_EDGE_CYCLES_PER_SAMPLE;
+	return (cycles + CH_TICK_CYCLES_PER_MS - 1) / CH_TICK_CYCLES_PER_MS;
+}
+
+/**
+ * CHugDarkCalibrate:
+ * @data: the offsets for the current multiplier are written here
+ *
+ * Measures and stores the dark offset of each color for the current
+ * multiplier, keeping those for the other multipliers.
+ **/
+static uint8_t
+CHugDarkCalibrate(uint8_t *data)
+{
+	uint8_t color_old = CHugGetColorSelect();
+	uint8_t multiplier;
+	uint32_t count;
+	uint16_t offset;
+	uint8_t i;
+
+	if (SensorIntegralTime == 0)
+		return CH_ERROR_INVALID_VALUE;
+
+	/* the offsets are for the multiplier the sensor is powered up at */
+	CHugSensorPowerUp(SensorIntegralTime);
+	multiplier = CHugGetMultiplier();
+
+	for (i = 0; i < 4; i++) {
+		CHugSetColorSelect(i);
+		count = CHugTakeReading(SensorIntegralTime);
+		if (reading_flags & CH_READING_FLAG_BOTH_EDGES)
+			count /= 2;
+
+		/* each reading can take 500ms */
+		CLRWDT();
+
+		/* anything over 0xfff is over the maximum at any time */
+		if (count > 0xfff)
+			count = CH_DARK_OFFSET_MAX;
+		else
+			count = (count << CH_DARK_OFFSET_SHIFT) / SensorIntegralTime;
+		offset = count > CH_DARK_OFFSET_MAX ? CH_DARK_OFFSET_MAX : count;
+		memcpy (&data[i * 2], (const void *) &offset, 2);
+	}
+	CHugSetColorSelect(color_old);
+
+	return CHugFlashUpdate(CH_EEPROM_ADDR_DARK_OFFSETS + multiplier * 8,
+			       8, data);
+}
+
+/**
+ * CHugStreamSample:
+ *
+ * Takes a reading and sends it to the host on the stream interface,
+ * or the bulk endpoint of the vendor interface.
+ **/
+static void
+CHugStreamSample(void)
+{
+	uint32_t reading;
+
+	/* the host is not listening */
+	if ((USBDeviceState < CONFIGURED_STATE) ||
+	    (USBSuspendControl == 1))
+		return;
+
+	/* the host has not collected the last sample, so drop this one */
+	if (HIDTxHandleBusy(USBStreamHandle)) {
+		stream_sample++;
+		return;
+	}
+
+	reading = CHugTakeReading(SensorIntegralTime);
+	memset (StreamBuffer, 0x00, sizeof (StreamBuffer));
+	memcpy (&StreamBuffer[0], (const void *) &stream_sample, 2);
+	StreamBuffer[2] = CHugGetColorSelect();
+	StreamBuffer[3] = CHugGetMultiplier() | reading_flags;
+	if (reading_flags & CH_READING_FLAG_DARK_SUBTRACTED)
+		reading = reading_corrected;
+	memcpy (&StreamBuffer[4], (const void *) &reading, 4);
+	memcpy (&StreamBuffer[8], (const void *) &reading_start, 4);
+	memcpy (&StreamBuffer[12], (const void *) &reading_end, 4);
+	USBStreamHandle = USBTxOnePacket(stream_ep,
+					 (BYTE*)&StreamBuffer[0],
+					 CH_USB_HID_STREAM_EP_SIZE);
+	stream_sample++;
+}
+
+/**
+ * CHugProgramFinish:
+ *
+ * Restores the color select and multiplier the program was started with.
+ **/
+static void
+CHugProgramFinish(void)
+{
+	program_state &= ~CH_PROGRAM_STATE_RUNNING;
+	CHugSetColorSelect(program_color_old);
+	if (CHugGetMultiplier() != CH_FREQ_SCALE_0)
+		CHugSensorSetMultiplier(program_multiplier_old);
+	else
+		SensorMultiplier = program_multiplier_old;
+}
+
+/**
+ * CHugProgramTick:
+ *
+ * Takes the reading for the next step of the program, and stops it
+ * after the last pass. If the host has not collected enough results
+ * then the reading is dropped and CH_PROGRAM_STATE_OVERFLOW is set,
+ * so that the timing of the later steps is kept.
+ **/
+static void
+CHugProgramTick(void)
+{
+	const ChProgramStep *step = &program_steps[program_step];
+	uint32_t reading;
+	uint8_t idx;
+
+	/* the sensor has to stay off while the bus is suspended */
+	if (USBSuspendControl == 1)
+		return;
+
+	CHugSetColorSelect(step->color_select);
+	CHugSensorSetMultiplier(step->multiplier);
+	reading = CHugTakeReading(step->integral_time);
+	if (reading_flags & CH_READING_FLAG_DARK_SUBTRACTED)
+		reading = reading_corrected;
+	if (program_results_len < CH_PROGRAM_RESULTS_MAX) {
+		idx = (program_results_head + program_results_len) %
+		      CH_PROGRAM_RESULTS_MAX;
+		program_results[idx] = reading;
+		program_results_len++;
+	} else {
+		program_state |= CH_PROGRAM_STATE_OVERFLOW;
+	}
+
+	/* a repeat of 0 runs until the host stops it */
+	if (++program_step < program_len)
+		return;
+	program_step = 0;
+	if (program_repeat != 0 && ++program_pass >= program_repeat) {
+		CHugSchedRemove(CHugProgramTick);
+		CHugProgramFinish();
+	}
+}
+
+/**
+ * CHugProgramStop:
+ **/
+static void
+CHugProgramStop(void)
+{
+	if ((program_state & CH_PROGRAM_STATE_RUNNING) == 0)
+		return;
+	CHugSchedRemove(CHugProgramTick);
+	CHugProgramFinish();
+}
+
+/**
+ * CHugProgramSet:
+ * @data: the program, as for CH_CMD_SET_PROGRAM
+ **/
+static uint8_t
+CHugProgramSet(const uint8_t *data)
+{
+	ChProgramStep step;
+	uint8_t len = data[4];
+	uint8_t i;
+
+	if (len > CH_PROGRAM_STEPS_MAX)
+		return CH_ERROR_INVALID_VALUE;
+	for (i = 0; i < len; i++) {
+		memcpy (&step, (const void *) &data[5 + i * 4], 4);
+		if (step.color_select > CH_COLOR_SELECT_GREEN ||
+		    step.multiplier == CH_FREQ_SCALE_0 ||
+		    step.multiplier > CH_FREQ_SCALE_100 ||
+		    step.integral_time == 0)
+			return CH_ERROR_INVALID_VALUE;
+	}
+
+	CHugProgramStop();
+	memcpy (&program_repeat, (const void *) &data[0], 2);
+	memcpy (&program_interval, (const void *) &data[2], 2);
+	memcpy (program_steps, (const void *) &data[5], len * 4);
+	program_len = len;
+	return CH_ERROR_NONE;
+}
+
+/**
+ * CHugProgramRun:
+ * @enable: %true to start the program from the first step
+ *
+ * Starting the program also discards any results not yet collected.
+ * A program with a step that takes longer than the interval is refused,
+ * as it would leave the main loop no time to talk to the host.
+ **/
+static uint8_t
+CHugProgramRun(bool enable)
+{
+	uint8_t i;
+
+	CHugProgramStop();
+	if (!enable)
+		return CH_ERROR_NONE;
+	if (program_len == 0)
+		return CH_ERROR_INVALID_VALUE;
+	for (i = 0; i < program_len; i++) {
+		if (program_interval <=
+		    CHugReadingTime(program_steps[i].integral_time))
+			return CH_ERROR_INVALID_VALUE;
+	}
+
+	program_step = 0;
+	program_pass = 0;
+	program_results_head = 0;
+	program_results_len = 0;
+	program_color_old = CHugGetColorSelect();
+	program_multiplier_old = SensorMultiplier;
+	program_state = CH_PROGRAM_STATE_RUNNING;
+	return CHugSchedAdd(CHugProgramTick, 1, program_interval);
+}
+
+/**
+ * CHugProgramGetResults:
+ * @data: the state and the oldest results are written here
+ *
+ * Returns the results to the host, removing them from the buffer.
+ **/
+static void
+CHugProgramGetResults(uint8_t *data)
+{
+	uint8_t len = program_results_len;
+	uint8_t i;
+
+	if (len > CH_PROGRAM_RESULTS_PER_FETCH)
+		len = CH_PROGRAM_RESULTS_PER_FETCH;
+	data[0] = program_state;
+	data[1] = len;
+	for (i = 0; i < len; i++) {
+		memcpy (&data[2 + i * 4],
+			(const void *) &program_results[program_results_head],
+			4);
+		program_results_head = (program_results_head + 1) %
+				       CH_PROGRAM_RESULTS_MAX;
+	}
+	program_results_len -= len;
+
+	/* the host has now been told about the dropped readings */
+	program_state &= ~CH_PROGRAM_STATE_OVERFLOW;
+}
+
+/**
+ * CHugCheckStreamRequest:
+ *
+ * Sends the report descriptor for the stream interface.
+ **/
+static void
+CHugCheckStreamRequest(void)
+{
+	if (SetupPkt.Recipient != USB_SETUP_RECIPIENT_INTERFACE_BITFIELD)
+		return;
+	if (SetupPkt.bIntfID != HID_STREAM_INTF_ID)
+		return;
+	if (SetupPkt.bRequest != USB_REQUEST_GET_DESCRIPTOR)
+		return;
+	if (SetupPkt.bDescriptorType != DSC_RPT)
+		return;
+	USBEP0SendROMPtr((ROM BYTE*)&hid_rpt02,
+			 HID_RPT02_SIZE,
+			 USB_EP0_INCLUDE_ZERO);
+}
+
+/**
+ * CHugDeviceIdle:
+ **/
+static void
+CHugDeviceIdle(void)
+{
+	/* wait for the host to collect the reply */
+	if (HIDTxHandleBusy(USBInHandle[0]) ||
+	    HIDTxHandleBusy(USBInHandle[1])) {
+		CHugSchedAdd(CHugDeviceIdle, CH_DEVICE_IDLE_DELAY, 0);
+		return;
+	}
+
+	switch (idle_command) {
+	case CH_CMD_RESET:
+		RESET();
+		break;
+	}
+	idle_command = 0x00;
+}
+
+/**
+ * CHugQueueRefill:
+ *
+ * Moves requests the host has sent onto the queue, oldest first, and
+ * keeps both halves of the OUT endpoint armed while there is room.
+ **/
+static void
+CHugQueueRefill(void)
+{
+	uint8_t idx;
+
+	/* the endpoint was reconfigured, so nothing is armed */
+	if (rx_reset) {
+		rx_reset = false;
+		rx_head = 0;
+		rx_pending = 0;
+		rx_armed = 0;
+		USBInHandle[0] = 0;
+		USBInHandle[1] = 0;
+		tx_idx = 0;
+	}
+
+	while (rx_armed > 0) {
+		idx = (rx_head + rx_pending) & (CH_CMD_QUEUE_SIZE - 1);
+		if (HIDRxHandleBusy(USBOutHandle[idx]))
+			break;
+		rx_pending++;
+		rx_armed--;
+	}
+	while (rx_armed < 2 && rx_pending + rx_armed < CH_CMD_QUEUE_SIZE) {
+		idx = (rx_head + rx_pending + rx_armed) & (CH_CMD_QUEUE_SIZE - 1);
+		USBOutHandle[idx] = HIDRxPacket(HID_EP,
+						(BYTE*)&RxBuffer[idx],
+						CH_USB_HID_EP_SIZE);
+		rx_armed++;
+	}
+}
+
+/**
+ * CHugWakeSetThreshold:
+ * @data: the new #ChWakeThreshold
+ **/
+static uint8_t
+CHugWakeSetThreshold(const uint8_t *data)
+{
+	ChWakeThreshold threshold;
+
+	memcpy (&threshold, (const void *) data, sizeof(ChWakeThreshold));
+	if (threshold.integral_time > CH_WAKE_INTEGRAL_TIME_MAX)
+		return CH_ERROR_INVALID_VALUE;
+	if (threshold.low > threshold.high)
+		return CH_ERROR_INVALID_VALUE;
+	wake_threshold = threshold;
+	return CH_ERROR_NONE;
+}
+
+/**
+ * CHugStatsCountCommand:
+ *
+ * The counts are only a byte each to save RAM, so they stop at 255
+ * rather than wrapping.
+ **/
+static void
+CHugStatsCountCommand(uint8_t cmd)
+{
+	uint8_t i;
+
+	for (i = 0; i < CH_STATS_CMDS_MAX - 1; i++) {
+		if (stats_cmds[i] == cmd)
+			break;
+	}
+	if (stats_cmd_count[i] != 0xff)
+		stats_cmd_count[i]++;
+}
+
+/**
+ * CHugStatsGetPage:
+ **/
+static uint8_t
+CHugStatsGetPage(uint8_t page, uint8_t flags, uint8_t *data)
+{
+	uint8_t first;
+	uint8_t i;
+
+	switch (page) {
+	case CH_STATS_PAGE_COUNTERS:
+		memcpy (data, (const void *) &stats, sizeof(ChStats));
+		if (flags & CH_STATS_FLAG_RESET)
+			memset (&stats, 0, sizeof(ChStats));
+		break;
+	default:
+		/* the command counts are split over several pages */
+		first = (page - CH_STATS_PAGE_COMMANDS) * CH_STATS_CMDS_PER_PAGE;
+		if (first >= CH_STATS_CMDS_MAX)
+			return CH_ERROR_INVALID_VALUE;
+		for (i = first;
+		     i < CH_STATS_CMDS_MAX && i < first + CH_STATS_CMDS_PER_PAGE;
+		     i++) {
+			data[0] = stats_cmds[i];
+			data[1] = stats_cmd_count[i];
+			if (flags & CH_STATS_FLAG_RESET)
+				stats_cmd_count[i] = 0;
+			data += 2;
+		}
+		break;
+	}
+	return CH_ERROR_NONE;
+}
+
+/**
+ * CHugProcessCommand:
+ * @rx: the request from the host
+ * @tx: the reply to send
+ *
+ * @rx and @tx can be the same buffer for commands that only read
+ * request data or only write reply data.
+ **/
+static void
+CHugProcessCommand(const uint8_t *rx, uint8_t *tx)
+{
+	uint32_t reading;
+	uint16_t interval;
+	uint16_t integral_time;
+	uint16_t frame;
+	ChFreqScale multiplier;
+	uint8_t cmd;
+	uint8_t rc = CH_ERROR_NONE;
+
+	cmd = rx[CH_BUFFER_INPUT_CMD];
+	CHugStatsCountCommand(cmd & ~CH_CMD_FLAG_SEQUENCE);
+	switch(cmd & ~CH_CMD_FLAG_SEQUENCE) {
+	case CH_CMD_GET_HARDWARE_VERSION:
+		tx[CH_BUFFER_OUTPUT_DATA] = 0x04;
+		break;
+	case CH_CMD_GET_COLOR_SELECT:
+		tx[CH_BUFFER_OUTPUT_DATA] = CHugGetColorSelect();
+		break;
+	case CH_CMD_SET_COLOR_SELECT:
+		CHugSetColorSelect(rx[CH_BUFFER_INPUT_DATA]);
+		break;
+	case CH_CMD_GET_LEDS:
+		tx[CH_BUFFER_OUTPUT_DATA] = CHugGetLEDs();
+		break;
+	case CH_CMD_SET_LEDS:
+		CHugLedSetPattern(rx[CH_BUFFER_INPUT_DATA + 0],
+				  rx[CH_BUFFER_INPUT_DATA + 1],
+				  rx[CH_BUFFER_INPUT_DATA + 2],
+				  rx[CH_BUFFER_INPUT_DATA + 3]);
+		break;
+	case CH_CMD_GET_MULTIPLIER:
+		tx[CH_BUFFER_OUTPUT_DATA] = CHugGetMultiplier();
+		break;
+	case CH_CMD_SET_MULTIPLIER:
+		if (rx[CH_BUFFER_INPUT_DATA] > CH_FREQ_SCALE_100) {
+			rc = CH_ERROR_INVALID_VALUE;
+			break;
+		}
+		CHugSensorSetMultiplier(rx[CH_BUFFER_INPUT_DATA]);
+		break;
+	case CH_CMD_GET_INTEGRAL_TIME:
+		memcpy (&tx[CH_BUFFER_OUTPUT_DATA],
+			(void *) &SensorIntegralTime,
+			2);
+		break;
+	case CH_CMD_SET_INTEGRAL_TIME:
+		memcpy (&integral_time,
+			(const void *) &rx[CH_BUFFER_INPUT_DATA],
+			2);
+		if (stream_running &&
+		    stream_interval <= CHugReadingTime(integral_time)) {
+			rc = CH_ERROR_INVALID_VALUE;
+			break;
+		}
+		SensorIntegralTime = integral_time;
+		break;
+	case CH_CMD_GET_POWER_TIMEOUT:
+		memcpy (&tx[CH_BUFFER_OUTPUT_DATA],
+			(void *) &SensorPowerTimeout,
+			2);
+		break;
+	case CH_CMD_SET_POWER_TIMEOUT:
+		memcpy (&SensorPowerTimeout,
+			(const void *) &rx[CH_BUFFER_INPUT_DATA],
+			2);
+		CHugSensorStartIdle();
+		break;
+	case CH_CMD_GET_WAKE_THRESHOLD:
+		memcpy (&tx[CH_BUFFER_OUTPUT_DATA],
+			(void *) &wake_threshold,
+			sizeof(ChWakeThreshold));
+		break;
+	case CH_CMD_SET_WAKE_THRESHOLD:
+		rc = CHugWakeSetThreshold(&rx[CH_BUFFER_INPUT_DATA]);
+		break;
+	case CH_CMD_GET_EDGE_MODE:
+		tx[CH_BUFFER_OUTPUT_DATA] = SensorEdgeMode;
+		break;
+	case CH_CMD_SET_EDGE_MODE:
+		if (rx[CH_BUFFER_INPUT_DATA] > CH_EDGE_MODE_BOTH) {
+			rc = CH_ERROR_INVALID_VALUE;
+			break;
+		}
+		SensorEdgeMode = rx[CH_BUFFER_INPUT_DATA];
+		break;
+	case CH_CMD_TAKE_DARK_CALIBRATION:
+		if (CHugArmPending()) {
+			rc = CH_ERROR_BUSY;
+			break;
+		}
+		rc = CHugDarkCalibrate(&tx[CH_BUFFER_OUTPUT_DATA]);
+		break;
+	case CH_CMD_GET_DARK_OFFSETS:
+		if (rx[CH_BUFFER_INPUT_DATA] > CH_FREQ_SCALE_100) {
+			rc = CH_ERROR_INVALID_VALUE;
+			break;
+		}
+		rc = CHugFlashRead(CH_EEPROM_ADDR_DARK_OFFSETS +
+				   rx[CH_BUFFER_INPUT_DATA] * 8,
+				   8, &tx[CH_BUFFER_OUTPUT_DATA]);
+		break;
+	case CH_CMD_GET_DARK_SUBTRACT:
+		tx[CH_BUFFER_OUTPUT_DATA] = SensorDarkSubtract;
+		break;
+	case CH_CMD_SET_DARK_SUBTRACT:
+		if (rx[CH_BUFFER_INPUT_DATA] > 1) {
+			rc = CH_ERROR_INVALID_VALUE;
+			break;
+		}
+		SensorDarkSubtract = rx[CH_BUFFER_INPUT_DATA];
+		break;
+	case CH_CMD_SELF_TEST:
+		if (CHugArmPending()) {
+			rc = CH_ERROR_BUSY;
+			break;
+		}
+		multiplier = CHugGetMultiplier();
+		rc = CHugSelfTestReport(&tx[CH_BUFFER_OUTPUT_DATA]);
+		CHugSensorSetMultiplier(multiplier);
+		break;
+	case CH_CMD_GET_TEMPERATURE:
+		rc = CHugTempRead((int16_t *) &tx[CH_BUFFER_OUTPUT_DATA]);
+		break;
+	case CH_CMD_GET_TEMP_COEFFICIENTS:
+		rc = CHugTempGetCoefficients(&tx[CH_BUFFER_OUTPUT_DATA]);
+		break;
+	case CH_CMD_SET_TEMP_COEFFICIENTS:
+		rc = CHugTempSetCoefficients(&rx[CH_BUFFER_INPUT_DATA]);
+		break;
+	case CH_CMD_GET_FIRMWARE_VERSION:
+		*((uint16_t *) &tx[CH_BUFFER_OUTPUT_DATA + 0]) = CH_VERSION_MAJOR;
+		*((uint16_t *) &tx[CH_BUFFER_OUTPUT_DATA + 2]) = CH_VERSION_MINOR;
+		*((uint16_t *) &tx[CH_BUFFER_OUTPUT_DATA + 4]) = CH_VERSION_MICRO;
+		break;
+	case CH_CMD_GET_SERIAL_NUMBER:
+		reading = 0x0;
+		memcpy (&tx[CH_BUFFER_OUTPUT_DATA],
+			(const void *) &reading,
+			4);
+		break;
+	case CH_CMD_TAKE_READING_RAW:
+		if (CHugArmPending()) {
+			rc = CH_ERROR_BUSY;
+			break;
+		}
+
+		/* take a single reading */
+		reading = CHugTakeReading(SensorIntegralTime);
+		memcpy (&tx[CH_BUFFER_OUTPUT_DATA],
+			(const void *) &reading,
+			sizeof(uint32_t));
+		memcpy (&tx[CH_BUFFER_OUTPUT_DATA + 4],
+			(const void *) &reading_start,
+			sizeof(ChTimestamp));
+		memcpy (&tx[CH_BUFFER_OUTPUT_DATA + 8],
+			(const void *) &reading_end,
+			sizeof(ChTimestamp));
+		tx[CH_BUFFER_OUTPUT_DATA + 12] = reading_flags;
+		memcpy (&tx[CH_BUFFER_OUTPUT_DATA + 13],
+			(const void *) &reading_corrected,
+			sizeof(uint32_t));
+		memcpy (&tx[CH_BUFFER_OUTPUT_DATA + 17],
+			(const void *) &reading_temperature,
+			2);
+		break;
+	case CH_CMD_SET_STREAM:
+		memcpy (&interval,
+			(const void *) &rx[CH_BUFFER_INPUT_DATA],
+			2);
+		if (interval == 0) {
+			CHugSchedRemove(CHugStreamSample);
+			stream_running = false;
+			break;
+		}
+		if (CHugArmPending()) {
+			rc = CH_ERROR_BUSY;
+			break;
+		}
+
+		/* each sample has to leave time for the main loop */
+		if (interval <= CHugReadingTime(SensorIntegralTime)) {
+			rc = CH_ERROR_INVALID_VALUE;
+			break;
+		}
+		stream_sample = 0;
+		stream_interval = interval;
+		if (rx[CH_BUFFER_INPUT_DATA + 2] & CH_STREAM_FLAG_BULK)
+			stream_ep = VENDOR_EP;
+		else
+			stream_ep = HID_STREAM_EP;
+		rc = CHugSchedAdd(CHugStreamSample, interval, interval);
+		stream_running = (rc == CH_ERROR_NONE);
+		break;
+	case CH_CMD_SET_PROGRAM:
+		rc = CHugProgramSet(&rx[CH_BUFFER_INPUT_DATA]);
+		break;
+	case CH_CMD_RUN_PROGRAM:
+		if (rx[CH_BUFFER_INPUT_DATA] > 1) {
+			rc = CH_ERROR_INVALID_VALUE;
+			break;
+		}
+		if (rx[CH_BUFFER_INPUT_DATA] == 1 && CHugArmPending()) {
+			rc = CH_ERROR_BUSY;
+			break;
+		}
+		rc = CHugProgramRun(rx[CH_BUFFER_INPUT_DATA]);
+		break;
+	case CH_CMD_GET_PROGRAM_RESULTS:
+		CHugProgramGetResults(&tx[CH_BUFFER_OUTPUT_DATA]);
+		break;
+	case CH_CMD_ARM_READING:
+		memcpy (&frame,
+			(const void *) &rx[CH_BUFFER_INPUT_DATA],
+			2);
+		if (frame > CH_USB_FRAME_MASK ||
+		    CHugFrameReached(((uint16_t) UFRMH << 8) | UFRML, frame)) {
+			rc = CH_ERROR_INVALID_VALUE;
+			break;
+		}
+
+		/* the reading is taken from the main loop, so anything else
+		 * taking readings from there would make it late */
+		if (stream_running ||
+		    (program_state & CH_PROGRAM_STATE_RUNNING) != 0) {
+			rc = CH_ERROR_BUSY;
+			break;
+		}
+
+		/* stop the SOF callback seeing a half-written frame */
+		arm_state = CH_ARM_STATE_IDLE;
+		arm_frame = frame;
+		arm_state = CH_ARM_STATE_WAITING;
+
+		/* get the warm-up out of the way before the frame */
+		if (CHugGetMultiplier() == CH_FREQ_SCALE_0)
+			CHugSensorSetMultiplier(SensorMultiplier);
+		break;
+	case CH_CMD_GET_ARMED_READING:
+		if (arm_state == CH_ARM_STATE_IDLE) {
+			rc = CH_ERROR_NOT_ARMED;
+			break;
+		}
+		if (arm_state != CH_ARM_STATE_DONE) {
+			rc = CH_ERROR_INCOMPLETE_REQUEST;
+			break;
+		}
+		memcpy (&tx[CH_BUFFER_OUTPUT_DATA],
+			(const void *) &arm_reading,
+			sizeof(uint32_t));
+		memcpy (&tx[CH_BUFFER_OUTPUT_DATA + 4],
+			(const void *) &arm_start,
+			sizeof(ChTimestamp));
+		memcpy (&tx[CH_BUFFER_OUTPUT_DATA + 8],
+			(const void *) &arm_end,
+			sizeof(ChTimestamp));
+		tx[CH_BUFFER_OUTPUT_DATA + 12] = arm_flags;
+		memcpy (&tx[CH_BUFFER_OUTPUT_DATA + 13],
+			(const void *) &arm_corrected,
+			sizeof(uint32_t));
+		memcpy (&tx[CH_BUFFER_OUTPUT_DATA + 17],
+			(const void *) &arm_temperature,
+			2);
+		break;
+	case CH_CMD_PING:
+		/* the token overlaps the reply when @rx is @tx */
+		memcpy (&reading,
+			(const void *) &rx[CH_BUFFER_INPUT_DATA],
+			4);
+		memcpy (&tx[CH_BUFFER_OUTPUT_DATA + 0],
+			(const void *) &reading,
+			4);
+		reading = CHugTickGetCycles32();
+		memcpy (&tx[CH_BUFFER_OUTPUT_DATA + 4],
+			(const void *) &reading,
+			4);
+		memcpy (&tx[CH_BUFFER_OUTPUT_DATA + 8],
+			(const void *) &process_cycles,
+			4);
+		break;
+	case CH_CMD_GET_STATS:
+		rc = CHugStatsGetPage(rx[CH_BUFFER_INPUT_DATA + 0],
+				      rx[CH_BUFFER_INPUT_DATA + 1],
+				      &tx[CH_BUFFER_OUTPUT_DATA]);
+		break;
+	case CH_CMD_GET_FAULT_LOG:
+		rc = CHugFlashRead(CH_EEPROM_ADDR_FAULT_LOG,
+				   CH_FAULT_LOG_SIZE,
+				   &tx[CH_BUFFER_OUTPUT_DATA]);
+		break;
+	case CH_CMD_CLEAR_FAULT_LOG:
+		rc = CHugFlashErase(CH_EEPROM_ADDR_FAULT_LOG,
+				    CH_FLASH_ERASE_BLOCK_SIZE);
+		break;
+	case CH_CMD_GET_TRACE:
+		rc = CHugTraceGetChunk(rx[CH_BUFFER_INPUT_DATA],
+				       &tx[CH_BUFFER_OUTPUT_DATA]);
+		break;
+	case CH_CMD_RESET:
+		/* only reset when USB stack is not busy */
+		idle_command = CH_CMD_RESET;
+		rc = CHugSchedAdd(CHugDeviceIdle, CH_DEVICE_IDLE_DELAY, 0);
+		break;
+	case CH_CMD_SET_FLASH_SUCCESS:
+		if (rx[CH_BUFFER_INPUT_DATA] != 0x01 &&
+		    rx[CH_BUFFER_INPUT_DATA] != 0xff) {
+			rc = CH_ERROR_INVALID_VALUE;
+			break;
+		}
+		rc = CHugFlashErase(CH_EEPROM_ADDR_FLASH_SUCCESS,
+				    CH_FLASH_ERASE_BLOCK_SIZE);
+		if (rc != CH_ERROR_NONE)
+			break;
+		rc = CHugFlashWrite(CH_EEPROM_ADDR_FLASH_SUCCESS, 1,
+				    &rx[CH_BUFFER_INPUT_DATA]);
+		break;
+	default:
+		rc = CH_ERROR_UNKNOWN_CMD;
+		break;
+	}
+
+	if (rc == CH_ERROR_INCOMPLETE_REQUEST)
+		stats.incomplete++;
+	tx[CH_BUFFER_OUTPUT_RETVAL] = rc;
+	tx[CH_BUFFER_OUTPUT_CMD] = cmd;
+	if (cmd & CH_CMD_FLAG_SEQUENCE)
+		tx[CH_BUFFER_OUTPUT_SEQUENCE] = rx[CH_BUFFER_INPUT_SEQUENCE];
 }
 
-static uint16_t		SensorIntegralTime = 0xffff;
-static ChFreqScale	multiplier_old = CH_FREQ_SCALE_0;
+/**
+ * ProcessIO:
+ **/
+static void
+ProcessIO(void)
+{
+	uint32_t start;
+	uint8_t *tx;
 
-/* this is used to map the firmware to a hardware version */
-static const char flash_id[] = CH_FIRMWARE_ID_TOKEN;
+	stats.process_io++;
 
-/* USB idle support */
-static uint8_t		idle_command = 0x00;
-static uint8_t		idle_counter = 0x00;
+	/* User Application USB tasks */
+	if ((USBDeviceState < CONFIGURED_STATE) ||
+	    (USBSuspendControl == 1))
+		return;
+
+	/* no data was received */
+	CHugQueueRefill();
+	if (rx_pending == 0)
+		return;
+
+	/* both replies are waiting for the host, so leave the request on
+	 * the queue, which NAKs any more once it is full */
+	if (HIDTxHandleBusy(USBInHandle[tx_idx]))
+		return;
+	tx = TxBuffer[tx_idx];
+
+	/* clear for debugging */
+	memset (tx, 0xff, CH_USB_HID_EP_SIZE);
+
+	/* always send return code */
+	start = CHugTickGetCycles32();
+	CHugProcessCommand(RxBuffer[rx_head], tx);
+	process_cycles = CHugTickGetCycles32() - start;
+	CHugTraceAdd(tx[CH_BUFFER_OUTPUT_CMD],
+		     tx[CH_BUFFER_OUTPUT_RETVAL],
+		     start,
+		     process_cycles);
+	USBInHandle[tx_idx] = HIDTxPacket(HID_EP,
+					  (BYTE*)tx,
+					  CH_USB_HID_EP_SIZE);
+	tx_idx ^= 1;
 
-/* USB buffers */
-static uint8_t RxBuffer[CH_USB_HID_EP_SIZE];
-static uint8_t TxBuffer[CH_USB_HID_EP_SIZE];
-USB_HANDLE		USBOutHandle = 0;
-USB_HANDLE		USBInHandle = 0;
+	/* the queue slot can now be re-armed */
+	rx_head = (rx_head + 1) & (CH_CMD_QUEUE_SIZE - 1);
+	rx_pending--;
+	CHugQueueRefill();
+}
 
 /**
- * CHugTakeReadingRaw:
+ * CHugArmTasks:
  *
- * The TAOS3200 sensor with the external IR filter gives the following rough
- * outputs with red selected at 100%:
- *
- *   Frequency   |   Condition
- * --------------|-------------------
- *    10Hz       | Aperture covered
- *    160Hz      | TFT backlight on, but masked to black
- *    1.24KHz    | 100 white at 170cd/m2
+ * Takes the armed reading once its frame has started. This is done from
+ * the main loop as the SOF callback may be in interrupt context.
  **/
-static uint32_t
-CHugTakeReadingRaw (uint32_t integral_time)
+static void
+CHugArmTasks(void)
 {
-	const uint8_t abs_scale[] = {  5, 5, 7, 6 }; /* red, white, blue, green */
-	uint32_t i;
-	uint32_t number_edges = 0;
-	uint32_t value;
-	uint8_t ra_tmp = PORTA;
-
-	/* wait for the output to change so we start on a new pulse
-	 * rising edge, which means more accurate black readings */
-	for (i = 0; i < integral_time; i++) {
-		if (ra_tmp != PORTA) {
-			/* ___      ____
-			 *    |____|    |___
-			 *
-			 *         ^- START HERE
-			 */
-			if (PORTAbits.RA4 == 1)
-				break;
-			ra_tmp = PORTA;
-		}
-	}
-
-	/* we got no change */
-	if (i == integral_time)
-		return 0;
+	if (arm_state != CH_ARM_STATE_TRIGGERED)
+		return;
+	arm_reading = CHugTakeReading(SensorIntegralTime);
+	arm_start = reading_start;
+	arm_end = reading_end;
+	arm_flags = reading_flags;
+	arm_corrected = reading_corrected;
+	arm_temperature = reading_temperature;
+	arm_state = CH_ARM_STATE_DONE;
+}
 
-	/* count how many times we get a rising edge */
-	for (i = 0; i < integral_time; i++) {
-		if (ra_tmp != PORTA) {
-			if (PORTAbits.RA4 == 1) {
-				number_edges++;
-				/* overflow */
-				if (number_edges == 0)
-					return UINT32_MAX;
-			}
-			ra_tmp = PORTA;
-		}
+/**
+ * CHugSensorTasks:
+ *
+ * Powers the sensor back up after a resume. This is done from the main
+ * loop as the resume callback may be in interrupt context.
+ *
+ * Once the sensor has warmed up, the output is also looked at on each
+ * pass so that the first pulse is skipped here rather than by the next
+ * reading. This means an armed reading does not wait for it.
+ **/
+static void
+CHugSensorTasks(void)
+{
+	if (sensor_resume) {
+		sensor_resume = false;
+		CHugSensorSetMultiplier(multiplier_old);
 	}
 
-	/* scale it according to the datasheet */
-	ra_tmp = CHugGetColorSelect();
-	value = number_edges * abs_scale[ra_tmp];
-
-	/* overflow */
-	if (value < number_edges)
-		return UINT32_MAX;
+	if (sensor_settled || CHugGetMultiplier() == CH_FREQ_SCALE_0)
+		return;
+	if (CHugTickGetCycles32() - sensor_power_start < CH_SENSOR_WARMUP_CYCLES)
+		return;
+	if (!CH_HAL_SENSOR_OUT)
+		sensor_seen_low = true;
+	else if (sensor_seen_low)
+		sensor_settled = true;
+}
 
-	return number_edges;
+/**
+ * CHugWakeEnabled:
+ *
+ * Returns: %true if readings are taken while the bus is suspended
+ **/
+static bool
+CHugWakeEnabled(void)
+{
+	return wake_threshold.integral_time != 0 &&
+	       USBGetRemoteWakeupStatus() == TRUE;
 }
 
 /**
- * CHugDeviceIdle:
+ * CHugWakeHost:
+ *
+ * Drives resume signalling on the bus, and then powers the sensor up as
+ * for a resume from the host.
  **/
 static void
-CHugDeviceIdle(void)
+CHugWakeHost(void)
 {
-	switch (idle_command) {
-	case CH_CMD_RESET:
-		RESET();
-		break;
-	}
-	idle_command = 0x00;
+	USBMaskInterrupts();
+	USBSuspendControl = 0;
+	USBBusIsSuspended = FALSE;
+	USBResumeControl = 1;
+	Delay10KTCYx(CH_WAKE_RESUME_DELAY);
+	USBResumeControl = 0;
+	USBUnmaskInterrupts();
+
+	stats.remote_wakeups++;
+	sensor_resume = true;
 }
 
 /**
- * ProcessIO:
+ * CHugWakeTasks:
+ *
+ * Takes a reading each time the device wakes up while the bus is
+ * suspended, powering the sensor down again straight afterwards, and
+ * wakes the host if it is outside the threshold. The device has been
+ * suspended for more than the 5ms needed before signalling a resume as
+ * it has slept since.
  **/
 static void
-ProcessIO(void)
+CHugWakeTasks(void)
 {
 	uint32_t reading;
-	uint8_t cmd;
-	uint8_t rc = CH_ERROR_NONE;
 
-	/* User Application USB tasks */
-	if ((USBDeviceState < CONFIGURED_STATE) ||
-	    (USBSuspendControl == 1))
+	if (!wake_slept)
+		return;
+	wake_slept = false;
+	if (USBSuspendControl != 1 || !CHugWakeEnabled())
 		return;
 
-	/* no data was received */
-	if (HIDRxHandleBusy(USBOutHandle)) {
-		if (idle_counter++ == 0xff &&
-		    idle_command != 0x00)
-			CHugDeviceIdle();
+	reading = CHugTakeReading(wake_threshold.integral_time);
+	CHugSensorSetMultiplier(CH_FREQ_SCALE_0);
+	if (reading < wake_threshold.low || reading > wake_threshold.high)
+		CHugWakeHost();
+}
+
+/**
+ * CHugSleepTasks:
+ *
+ * Sleeps while the bus is suspended, which stops the CPU clock and the
+ * timers until there is activity on the bus. The USB module and the
+ * sample timing need the full clock at any other time.
+ **/
+static void
+CHugSleepTasks(void)
+{
+	uint8_t gie;
+	uint8_t peie;
+	uint8_t usbie;
+
+	if (USBSuspendControl != 1)
 		return;
-	}
 
-	/* we're waiting for a read from the host */
-	if (HIDTxHandleBusy(USBInHandle)) {
-		/* hijack the pending read with the new error */
-		TxBuffer[CH_BUFFER_OUTPUT_RETVAL] = CH_ERROR_INCOMPLETE_REQUEST;
-		goto re_arm_rx;
-	}
+	/* do not sleep through a resume handled by the ISR just now */
+	gie = INTCONbits.GIE;
+	INTCONbits.GIE = 0;
+	if (USBSuspendControl == 1) {
+		/* bus activity wakes the device even without USB_INTERRUPT,
+		 * and the ISR handles it once GIE is restored */
+		peie = INTCONbits.PEIE;
+		usbie = PIE2bits.USBIE;
+		INTCONbits.PEIE = 1;
+		PIE2bits.USBIE = 1;
 
-	/* got data, reset idle counter */
-	idle_counter = 0;
+		/* the watchdog wakes the device rather than resetting it */
+		if (CHugWakeEnabled()) {
+			CLRWDT();
+			WDTCONbits.WDTPS = CH_WAKE_WDTPS;
+			WDTCONbits.SWDTEN = 1;
+		}
+		stats.sleeps++;
+		SLEEP();
+		NOP();
+		WDTCONbits.SWDTEN = 0;
+		PIE2bits.USBIE = usbie;
+		INTCONbits.PEIE = peie;
+		wake_slept = true;
 
-	/* clear for debugging */
-	memset (TxBuffer, 0xff, sizeof (TxBuffer));
+		/* the USB module needs the PLL to lock again */
+		while (!OSCSTATbits.PLLRDY);
+	}
+	INTCONbits.GIE = gie;
+}
 
-	cmd = RxBuffer[CH_BUFFER_INPUT_CMD];
-	switch(cmd) {
-	case CH_CMD_GET_HARDWARE_VERSION:
-		TxBuffer[CH_BUFFER_OUTPUT_DATA] = 0x04;
-		break;
+/**
+ * CHugFeatureCommandAllowed:
+ *
+ * Only commands that are quick enough to not hold up the control
+ * endpoint can be used with feature reports.
+ **/
+static bool
+CHugFeatureCommandAllowed(uint8_t cmd)
+{
+	switch (cmd) {
 	case CH_CMD_GET_COLOR_SELECT:
-		TxBuffer[CH_BUFFER_OUTPUT_DATA] = CHugGetColorSelect();
-		break;
 	case CH_CMD_SET_COLOR_SELECT:
-		CHugSetColorSelect(RxBuffer[CH_BUFFER_INPUT_DATA]);
-		break;
-	case CH_CMD_GET_LEDS:
-		TxBuffer[CH_BUFFER_OUTPUT_DATA] = CHugGetLEDs();
-		break;
-	case CH_CMD_SET_LEDS:
-		CHugSetLEDs(RxBuffer[CH_BUFFER_INPUT_DATA + 0]);
-		break;
 	case CH_CMD_GET_MULTIPLIER:
-		TxBuffer[CH_BUFFER_OUTPUT_DATA] = CHugGetMultiplier();
-		break;
 	case CH_CMD_SET_MULTIPLIER:
-		CHugSetMultiplier(RxBuffer[CH_BUFFER_INPUT_DATA]);
-		break;
 	case CH_CMD_GET_INTEGRAL_TIME:
-		memcpy (&TxBuffer[CH_BUFFER_OUTPUT_DATA],
-			(void *) &SensorIntegralTime,
-			2);
-		break;
 	case CH_CMD_SET_INTEGRAL_TIME:
-		memcpy (&SensorIntegralTime,
-			(const void *) &RxBuffer[CH_BUFFER_INPUT_DATA],
-			2);
-		break;
+	case CH_CMD_GET_POWER_TIMEOUT:
+	case CH_CMD_SET_POWER_TIMEOUT:
+	case CH_CMD_GET_WAKE_THRESHOLD:
+	case CH_CMD_SET_WAKE_THRESHOLD:
+	case CH_CMD_GET_EDGE_MODE:
+	case CH_CMD_SET_EDGE_MODE:
+	case CH_CMD_GET_DARK_OFFSETS:
+	case CH_CMD_GET_DARK_SUBTRACT:
+	case CH_CMD_SET_DARK_SUBTRACT:
+	case CH_CMD_GET_TEMPERATURE:
+	case CH_CMD_GET_TEMP_COEFFICIENTS:
 	case CH_CMD_GET_FIRMWARE_VERSION:
-		*((uint16_t *) &TxBuffer[CH_BUFFER_OUTPUT_DATA + 0]) = CH_VERSION_MAJOR;
-		*((uint16_t *) &TxBuffer[CH_BUFFER_OUTPUT_DATA + 2]) = CH_VERSION_MINOR;
-		*((uint16_t *) &TxBuffer[CH_BUFFER_OUTPUT_DATA + 4]) = CH_VERSION_MICRO;
-		break;
 	case CH_CMD_GET_SERIAL_NUMBER:
-		reading = 0x0;
-		memcpy (&TxBuffer[CH_BUFFER_OUTPUT_DATA],
-			(const void *) &reading,
-			4);
-		break;
-	case CH_CMD_TAKE_READING_RAW:
-		/* take a single reading */
-		reading = CHugTakeReadingRaw(SensorIntegralTime);
-		memcpy (&TxBuffer[CH_BUFFER_OUTPUT_DATA],
-			(const void *) &reading,
-			sizeof(uint32_t));
-		break;
-	case CH_CMD_RESET:
-		/* only reset when USB stack is not busy */
-		idle_command = CH_CMD_RESET;
-		break;
-	case CH_CMD_SET_FLASH_SUCCESS:
-		if (RxBuffer[CH_BUFFER_INPUT_DATA] != 0x01 &&
-		    RxBuffer[CH_BUFFER_INPUT_DATA] != 0xff) {
-			rc = CH_ERROR_INVALID_VALUE;
-			break;
-		}
-		rc = CHugFlashErase(CH_EEPROM_ADDR_FLASH_SUCCESS,
-				    CH_FLASH_ERASE_BLOCK_SIZE);
-		if (rc != CH_ERROR_NONE)
-			break;
-		rc = CHugFlashWrite(CH_EEPROM_ADDR_FLASH_SUCCESS, 1,
-				    &RxBuffer[CH_BUFFER_INPUT_DATA]);
-		break;
+	case CH_CMD_GET_LEDS:
+	case CH_CMD_SET_LEDS:
+	case CH_CMD_GET_HARDWARE_VERSION:
+	case CH_CMD_PING:
+		return true;
 	default:
-		rc = CH_ERROR_UNKNOWN_CMD;
 		break;
 	}
+	return false;
+}
 
-	/* always send return code */
-	if(!HIDTxHandleBusy(USBInHandle)) {
-		TxBuffer[CH_BUFFER_OUTPUT_RETVAL] = rc;
-		TxBuffer[CH_BUFFER_OUTPUT_CMD] = cmd;
-		USBInHandle = HIDTxPacket(HID_EP,
-					  (BYTE*)&TxBuffer[0],
-					  CH_USB_HID_EP_SIZE);
+/**
+ * CHugFeatureProcess:
+ *
+ * Runs the command in FeatureBuffer, replacing it with the reply.
+ **/
+static void
+CHugFeatureProcess(void)
+{
+	uint8_t cmd = FeatureBuffer[CH_BUFFER_INPUT_CMD] & ~CH_CMD_FLAG_SEQUENCE;
+
+	FeatureBuffer[CH_BUFFER_INPUT_CMD] = cmd;
+	if (!CHugFeatureCommandAllowed(cmd)) {
+		FeatureBuffer[CH_BUFFER_OUTPUT_RETVAL] = CH_ERROR_UNKNOWN_CMD;
+		FeatureBuffer[CH_BUFFER_OUTPUT_CMD] = cmd;
+		return;
+	}
+	CHugProcessCommand(FeatureBuffer, FeatureBuffer);
+}
+
+/**
+ * CHugFeatureTasks:
+ *
+ * Completes any feature report requests. This is done from the main
+ * loop rather than the USB callbacks, which may be in interrupt context.
+ **/
+static void
+CHugFeatureTasks(void)
+{
+	/* SET_REPORT data stage has completed, and the status stage is
+	 * held off until the command has been run */
+	if (feature_set_pending) {
+		CHugFeatureProcess();
+		feature_set_pending = false;
+		USBCtrlEPAllowStatusStage();
+	}
+
+	/* GET_REPORT data stage is waiting for the reply */
+	if (feature_get_pending) {
+		feature_get_pending = false;
+		USBEP0SendRAMPtr((BYTE*)&FeatureBuffer,
+				 CH_USB_HID_EP_SIZE,
+				 USB_EP0_INCLUDE_ZERO);
+		USBCtrlEPAllowDataStage();
 	}
-re_arm_rx:
-	/* re-arm the OUT endpoint for the next packet */
-	USBOutHandle = HIDRxPacket(HID_EP,
-				   (BYTE*)&RxBuffer,
-				   CH_USB_HID_EP_SIZE);
+}
+
+/**
+ * CHugFeatureReceived:
+ *
+ * The host cannot start another control transfer until the status
+ * stage has completed, so FeatureBuffer is left alone until it has
+ * been processed.
+ **/
+static void
+CHugFeatureReceived(void)
+{
+	USBDeferStatusStage();
+	feature_set_pending = true;
+}
+
+/**
+ * CHugGetReportHandler:
+ *
+ * Handles GET_REPORT for the feature report, which returns the reply to
+ * the last SET_REPORT. The report descriptor has no report IDs, so only
+ * report ID 0 is accepted.
+ **/
+void
+CHugGetReportHandler(void)
+{
+	if (SetupPkt.W_Value.byte.HB != CH_HID_REPORT_TYPE_FEATURE)
+		return;
+	if (SetupPkt.W_Value.byte.LB != 0)
+		return;
+	feature_get_pending = true;
+	USBDeferINDataStage();
+}
+
+/**
+ * CHugSetReportHandler:
+ *
+ * Handles SET_REPORT for the feature report, which is run as a command
+ * when the data stage is complete.
+ **/
+void
+CHugSetReportHandler(void)
+{
+	if (SetupPkt.W_Value.byte.HB != CH_HID_REPORT_TYPE_FEATURE)
+		return;
+	if (SetupPkt.W_Value.byte.LB != 0)
+		return;
+	if (SetupPkt.wLength > CH_USB_HID_EP_SIZE)
+		return;
+	if (feature_set_pending)
+		return;
+	USBEP0Receive((BYTE*)&FeatureBuffer,
+		      SetupPkt.wLength,
+		      CHugFeatureReceived);
 }
 
 /**
@@ -279,17 +1658,28 @@ USER_USB_CALLBACK_EVENT_HANDLER(int event, void *pdata, WORD size)
 	switch(event) {
 	case EVENT_TRANSFER:
 		break;
+	case EVENT_SOF:
+		sof_cycles = CHugTickGetCycles();
+		sof_frame = ((uint16_t) UFRMH << 8) | UFRML;
+		if (arm_state == CH_ARM_STATE_WAITING &&
+		    CHugFrameReached(((uint16_t) UFRMH << 8) | UFRML, arm_frame))
+			arm_state = CH_ARM_STATE_TRIGGERED;
+		break;
 	case EVENT_SUSPEND:
-		/* need to reduce power to < 2.5mA, so power down sensor */
+		/* need to reduce power to < 2.5mA, so power down sensor,
+		 * and the main loop then sleeps until the bus is resumed */
 		multiplier_old = CHugGetMultiplier();
 		CHugSetMultiplier(CH_FREQ_SCALE_0);
 
 		/* power down LEDs */
-		CHugSetLEDs(0);
+		CHugLedSetPattern(0, 0, 0, 0);
+		stats.suspends++;
 		break;
 	case EVENT_RESUME:
-		/* restore full power mode */
-		CHugSetMultiplier(multiplier_old);
+		stats.resumes++;
+		/* restore full power mode from the main loop, which also
+		 * tracks the warm-up and restarts the idle timeout */
+		sensor_resume = true;
 		break;
 	case EVENT_CONFIGURED:
 		/* enable the HID endpoint */
@@ -298,14 +1688,23 @@ USER_USB_CALLBACK_EVENT_HANDLER(int event, void *pdata, WORD size)
 				  USB_OUT_ENABLED|
 				  USB_HANDSHAKE_ENABLED|
 				  USB_DISALLOW_SETUP);
+		USBEnableEndpoint(HID_STREAM_EP,
+				  USB_IN_ENABLED|
+				  USB_HANDSHAKE_ENABLED|
+				  USB_DISALLOW_SETUP);
+		USBEnableEndpoint(VENDOR_EP,
+				  USB_IN_ENABLED|
+				  USB_HANDSHAKE_ENABLED|
+				  USB_DISALLOW_SETUP);
+		USBStreamHandle = 0;
 
-		/* re-arm the OUT endpoint for the next packet */
-		USBOutHandle = HIDRxPacket(HID_EP,
-					   (BYTE*)&RxBuffer,
-					   CH_USB_HID_EP_SIZE);
+		/* the queue is emptied and re-armed from ProcessIO as this
+		 * may be called from the ISR */
+		rx_reset = true;
 		break;
 	case EVENT_EP0_REQUEST:
 		USBCheckHIDRequest();
+		CHugCheckStreamRequest();
 		break;
 	case EVENT_TRANSFER_TERMINATED:
 		break;
@@ -316,13 +1715,11 @@ USER_USB_CALLBACK_EVENT_HANDLER(int event, void *pdata, WORD size)
 }
 
 /**
- * main:
+ * CHugInit:
  **/
-void
-main(void)
+static void
+CHugInit(void)
 {
-	uint8_t i;
-
 	/* The USB module will be enabled if the bootloader has booted,
 	 * so we soft-detach from the host. */
 	if(UCONbits.USBEN == 1) {
@@ -336,30 +1733,81 @@ main(void)
 	CHugSetColorSelect(CH_COLOR_SELECT_WHITE);
 	CHugSetMultiplier(CH_FREQ_SCALE_0);
 
+	/* start the timers */
+	CHugTickInit();
+	CHugSchedAdd(CHugLedTick, 1, 1);
+
+	/* the temperature indicator settles before the first reading */
+	CHugTempInit();
+
 	/* Initializes USB module SFRs and firmware variables to known states */
 	USBDeviceInit();
 	USBDeviceAttach();
 
+#if defined(USB_INTERRUPT)
+	/* the bus and the tick are serviced from ISRCode */
+	CHugTickEnableInterrupt();
+	INTCONbits.GIE = 1;
+#endif
+
 	/* do the welcome flash */
-	for (i = 0; i < 3; i++) {
-		CHugSetLEDs(1);
-		Delay10KTCYx(0x5f);
-		CHugSetLEDs(0);
-		Delay10KTCYx(0x5f);
-	}
+	CHugLedSetPattern(1, 3, 80, 80);
 
 	/* convince the compiler it's actually used */
 	if (flash_id[0] == '\0')
 		CHugFatalError(CH_ERROR_WRONG_UNLOCK_CODE);
 
-	while(1) {
+	loop_start = CHugTickGetCycles32();
+}
 
-		/* clear watchdog */
-		CLRWDT();
+/**
+ * CHugTasks:
+ *
+ * One iteration of the main loop.
+ **/
+static void
+CHugTasks(void)
+{
+	uint32_t loop_end;
+	uint32_t loop_cycles;
 
-		/* check bus status and service USB interrupts */
-		USBDeviceTasks();
+	/* clear watchdog */
+	CLRWDT();
 
-		ProcessIO();
-	}
+	/* time the previous iteration */
+	loop_end = CHugTickGetCycles32();
+	loop_cycles = loop_end - loop_start;
+	loop_start = loop_end;
+	if (loop_cycles > stats.loop_max)
+		stats.loop_max = loop_cycles;
+	if (loop_cycles > CH_STATS_WATCHDOG_NEAR_MISS)
+		stats.watchdog_near_misses++;
+
+#if defined(USB_POLLING)
+	/* check bus status and service USB interrupts */
+	USBDeviceTasks();
+#endif
+
+	CHugSensorTasks();
+	CHugArmTasks();
+	ProcessIO();
+	CHugFeatureTasks();
+
+	/* run any timers that have expired */
+	CHugSchedRun();
+
+	/* nothing more to do until the host resumes the bus */
+	CHugWakeTasks();
+	CHugSleepTasks();
+}
+
+/**
+ * main:
+ **/
+void
+main(void)
+{
+	CHugInit();
+	while(1)
+		CHugTasks();
 }
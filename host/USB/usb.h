@@ -0,0 +1,187 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Stands in for the Microchip USB device stack when building for the
+ * host. Only the parts used by the firmware are provided, and packets
+ * are exchanged using the functions in ch-usb-host.h.
+ */
+
+#ifndef __CH_HOST_USB_H
+#define __CH_HOST_USB_H
+
+#include <stdint.h>
+
+#include "usb_config.h"
+
+typedef uint8_t		 BYTE;
+typedef uint16_t	 WORD;
+typedef uint32_t	 DWORD;
+typedef uint8_t		 BOOL;
+typedef void		*USB_HANDLE;
+
+#define	TRUE			1
+#define	FALSE			0
+#define	ROM			const
+
+typedef struct {
+	BYTE		 bLength;
+	BYTE		 bDescriptorType;
+	WORD		 bcdUSB;
+	BYTE		 bDeviceClass;
+	BYTE		 bDeviceSubClass;
+	BYTE		 bDeviceProtocol;
+	BYTE		 bMaxPacketSize0;
+	WORD		 idVendor;
+	WORD		 idProduct;
+	WORD		 bcdDevice;
+	BYTE		 iManufacturer;
+	BYTE		 iProduct;
+	BYTE		 iSerialNumber;
+	BYTE		 bNumConfigurations;
+} USB_DEVICE_DESCRIPTOR;
+
+/* the fields that alias each other in the real stack are separate */
+typedef struct {
+	BYTE		 bmRequestType;
+	BYTE		 bRequest;
+	WORD		 wIndex;
+	WORD		 wLength;
+	unsigned	 Recipient:5;
+	unsigned	 RequestType:2;
+	unsigned	 DataDir:1;
+	BYTE		 bIntfID;
+	BYTE		 bDescriptorType;
+	union {
+		WORD	 Val;
+		struct {
+			BYTE	 LB;
+			BYTE	 HB;
+		} byte;
+	} W_Value;
+} CTRL_TRF_SETUP;
+
+#define	USB_DESCRIPTOR_DEVICE			0x01
+#define	USB_DESCRIPTOR_CONFIGURATION		0x02
+#define	USB_DESCRIPTOR_STRING			0x03
+#define	USB_DESCRIPTOR_INTERFACE		0x04
+#define	USB_DESCRIPTOR_ENDPOINT			0x05
+#define	USB_REQUEST_GET_DESCRIPTOR		0x06
+
+#define	_DEFAULT				0x80
+#define	_SELF					0x40
+#define	_RWU					0x20
+#define	_EP_IN					0x80
+#define	_EP_OUT					0x00
+#define	_BULK					0x02
+#define	_INTERRUPT				0x03
+
+#define	USB_SETUP_HOST_TO_DEVICE_BITFIELD	0
+#define	USB_SETUP_DEVICE_TO_HOST_BITFIELD	1
+#define	USB_SETUP_TYPE_STANDARD_BITFIELD	0
+#define	USB_SETUP_TYPE_CLASS_BITFIELD		1
+#define	USB_SETUP_RECIPIENT_DEVICE_BITFIELD	0
+#define	USB_SETUP_RECIPIENT_INTERFACE_BITFIELD	1
+
+#define	USB_IN_ENABLED				0x02
+#define	USB_OUT_ENABLED				0x04
+#define	USB_HANDSHAKE_ENABLED			0x10
+#define	USB_DISALLOW_SETUP			0x08
+
+#define	USB_EP0_ROM				0x00
+#define	USB_EP0_RAM				0x01
+#define	USB_EP0_BUSY				0x80
+#define	USB_EP0_INCLUDE_ZERO			0x40
+#define	USB_EP0_NO_DATA				0x00
+#define	USB_EP0_NO_OPTIONS			0x00
+
+enum {
+	DETACHED_STATE,
+	ATTACHED_STATE,
+	POWERED_STATE,
+	DEFAULT_STATE,
+	ADR_PENDING_STATE,
+	ADDRESS_STATE,
+	CONFIGURED_STATE
+};
+
+enum {
+	EVENT_NONE,
+	EVENT_DEVICE_STACK_BASE,
+	EVENT_TRANSFER,
+	EVENT_SOF,
+	EVENT_RESUME,
+	EVENT_SUSPEND,
+	EVENT_RESET,
+	EVENT_CONFIGURED,
+	EVENT_SET_DESCRIPTOR,
+	EVENT_EP0_REQUEST,
+	EVENT_BUS_ERROR,
+	EVENT_TRANSFER_TERMINATED
+};
+
+extern volatile BYTE		 USBDeviceState;
+extern volatile BYTE		 USBActiveConfiguration;
+extern volatile BOOL		 RemoteWakeup;
+extern volatile BOOL		 USBBusIsSuspended;
+extern volatile CTRL_TRF_SETUP	 SetupPkt;
+
+#define	USBSuspendControl		UCONbits.SUSPND
+#define	USBResumeControl		UCONbits.RESUME
+#define	USBGetRemoteWakeupStatus()	RemoteWakeup
+#define	USBIsBusSuspended()		USBBusIsSuspended
+
+void		 USBDeviceInit		(void);
+void		 USBDeviceAttach	(void);
+void		 USBDeviceTasks		(void);
+void		 USBEnableEndpoint	(BYTE		 ep,
+					 BYTE		 options);
+USB_HANDLE	 USBTxOnePacket		(BYTE		 ep,
+					 BYTE		*data,
+					 WORD		 len);
+USB_HANDLE	 USBRxOnePacket		(BYTE		 ep,
+					 BYTE		*data,
+					 WORD		 len);
+BOOL		 USBHandleBusy		(USB_HANDLE	 handle);
+WORD		 USBHandleGetLength	(USB_HANDLE	 handle);
+void		 USBEP0SendRAMPtr	(BYTE		*src,
+					 WORD		 size,
+					 BYTE		 options);
+void		 USBEP0SendROMPtr	(ROM BYTE	*src,
+					 WORD		 size,
+					 BYTE		 options);
+void		 USBEP0Receive		(BYTE		*dest,
+					 WORD		 size,
+					 void		(*func)(void));
+void		 USBDeferINDataStage	(void);
+void		 USBDeferOUTDataStage	(void);
+void		 USBCtrlEPAllowDataStage (void);
+void		 USBDeferStatusStage	(void);
+void		 USBCtrlEPAllowStatusStage (void);
+void		 USBMaskInterrupts	(void);
+void		 USBUnmaskInterrupts	(void);
+
+/* provided by the firmware */
+BOOL		 USER_USB_CALLBACK_EVENT_HANDLER (int		 event,
+					 void		*pdata,
+					 WORD		 size);
+
+#endif /* __CH_HOST_USB_H */
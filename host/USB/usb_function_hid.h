@@ -0,0 +1,45 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __CH_HOST_USB_FUNCTION_HID_H
+#define __CH_HOST_USB_FUNCTION_HID_H
+
+#include <USB/usb.h>
+
+#define	HID_INTF				0x03
+#define	DSC_HID					0x21
+#define	DSC_RPT					0x22
+
+#define	GET_REPORT				0x01
+#define	GET_IDLE				0x02
+#define	GET_PROTOCOL				0x03
+#define	SET_REPORT				0x09
+#define	SET_IDLE				0x0a
+#define	SET_PROTOCOL				0x0b
+
+#define	HIDTxPacket				USBTxOnePacket
+#define	HIDRxPacket				USBRxOnePacket
+#define	HIDTxHandleBusy				USBHandleBusy
+#define	HIDRxHandleBusy				USBHandleBusy
+
+void		 USBCheckHIDRequest	(void);
+
+#endif /* __CH_HOST_USB_FUNCTION_HID_H */
@@ -0,0 +1,377 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Times each command in the simulation, comparing the results with a
+ * baseline so that a change that makes the firmware slower is noticed,
+ * and checks that the sensor is counted correctly up to the highest
+ * output frequency the edge counter is specified for.
+ *
+ * The simulated clock only counts the cost of reading the sensor, the
+ * flash stalls and going around the main loop, so simple commands take
+ * no cycles at all. Only the commands that take simulated cycles are
+ * compared; the wall clock time is shown for the others but depends on
+ * the host.
+ */
+
+#include "ColorHug.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ch-bench.h"
+#include "ch-edge.h"
+#include "ch-flash.h"
+#include "ch-hal-host.h"
+#include "ch-host.h"
+
+/* how many times each command is run */
+#define	CH_BENCH_REPEAT				16
+
+/* the fractions of CH_EDGE_MAX_FREQUENCY the readings are checked at */
+#define	CH_BENCH_FREQ_STEPS			10
+
+/* how far the count can be from the expected number of edges */
+#define	CH_BENCH_FREQ_ERROR_PERCENT		2
+
+#define	CH_BENCH_MAX_RESULTS			64
+
+typedef struct {
+	const char	*name;
+	uint8_t		 cmd;
+	uint8_t		 data[4];
+	uint8_t		 len;
+} ChBenchCommand;
+
+typedef struct {
+	char		 name[32];
+	uint32_t	 value;
+} ChBenchResult;
+
+static const ChBenchCommand bench_cmds[] = {
+	{ "get-color-select",	CH_CMD_GET_COLOR_SELECT,	{ 0 }, 0 },
+	{ "set-color-select",	CH_CMD_SET_COLOR_SELECT,	{ CH_COLOR_SELECT_WHITE }, 1 },
+	{ "get-multiplier",	CH_CMD_GET_MULTIPLIER,		{ 0 }, 0 },
+	{ "set-multiplier",	CH_CMD_SET_MULTIPLIER,		{ CH_FREQ_SCALE_100 }, 1 },
+	{ "get-integral-time",	CH_CMD_GET_INTEGRAL_TIME,	{ 0 }, 0 },
+	{ "set-integral-time",	CH_CMD_SET_INTEGRAL_TIME,	{ 0x00, 0x10 }, 2 },
+	{ "get-power-timeout",	CH_CMD_GET_POWER_TIMEOUT,	{ 0 }, 0 },
+	{ "set-power-timeout",	CH_CMD_SET_POWER_TIMEOUT,	{ 0x88, 0x13 }, 2 },
+	{ "get-wake-threshold",	CH_CMD_GET_WAKE_THRESHOLD,	{ 0 }, 0 },
+	{ "set-wake-threshold",	CH_CMD_SET_WAKE_THRESHOLD,	{ 0 }, 0 },
+	{ "get-edge-mode",	CH_CMD_GET_EDGE_MODE,		{ 0 }, 0 },
+	{ "set-edge-mode",	CH_CMD_SET_EDGE_MODE,		{ CH_EDGE_MODE_RISING }, 1 },
+	{ "get-dark-offsets",	CH_CMD_GET_DARK_OFFSETS,	{ CH_FREQ_SCALE_100 }, 1 },
+	{ "get-dark-subtract",	CH_CMD_GET_DARK_SUBTRACT,	{ 0 }, 0 },
+	{ "set-dark-subtract",	CH_CMD_SET_DARK_SUBTRACT,	{ 0 }, 1 },
+	{ "get-temperature",	CH_CMD_GET_TEMPERATURE,		{ 0 }, 0 },
+	{ "get-temp-coeffs",	CH_CMD_GET_TEMP_COEFFICIENTS,	{ 0 }, 0 },
+	{ "get-firmware-ver",	CH_CMD_GET_FIRMWARE_VERSION,	{ 0 }, 0 },
+	{ "get-serial-number",	CH_CMD_GET_SERIAL_NUMBER,	{ 0 }, 0 },
+	{ "get-leds",		CH_CMD_GET_LEDS,		{ 0 }, 0 },
+	{ "set-leds",		CH_CMD_SET_LEDS,		{ 0, 0, 0, 0 }, 4 },
+	{ "get-hardware-ver",	CH_CMD_GET_HARDWARE_VERSION,	{ 0 }, 0 },
+	{ "take-reading-raw",	CH_CMD_TAKE_READING_RAW,	{ 0 }, 0 },
+	{ "self-test",		CH_CMD_SELF_TEST,		{ 0 }, 0 },
+	{ "set-stream",		CH_CMD_SET_STREAM,		{ 0, 0, 0 }, 3 },
+	{ "set-program",	CH_CMD_SET_PROGRAM,		{ 0 }, 0 },
+	{ "run-program",	CH_CMD_RUN_PROGRAM,		{ 0 }, 1 },
+	{ "get-program-results", CH_CMD_GET_PROGRAM_RESULTS, { 0 }, 0 },
+	{ "get-armed-reading",	CH_CMD_GET_ARMED_READING,	{ 0 }, 0 },
+	{ "ping",		CH_CMD_PING,			{ 1, 2, 3, 4 }, 4 },
+	{ "get-stats",		CH_CMD_GET_STATS,		{ 0, 0 }, 2 },
+	{ "get-trace",		CH_CMD_GET_TRACE,		{ 0 }, 1 },
+	{ "get-fault-log",	CH_CMD_GET_FAULT_LOG,		{ 0 }, 0 },
+	{ "clear-fault-log",	CH_CMD_CLEAR_FAULT_LOG,		{ 0 }, 0 },
+	{ "set-flash-success",	CH_CMD_SET_FLASH_SUCCESS,	{ 0x01 }, 1 },
+	{ NULL,			0x00,				{ 0 }, 0 }
+};
+
+static ChBenchResult	bench_results[CH_BENCH_MAX_RESULTS];
+static uint8_t		bench_results_len = 0;
+
+/**
+ * CHugBenchAddResult:
+ **/
+static void
+CHugBenchAddResult(const char *name, uint32_t value)
+{
+	ChBenchResult *result = &bench_results[bench_results_len++];
+
+	snprintf(result->name, sizeof(result->name), "%s", name);
+	result->value = value;
+}
+
+/**
+ * CHugBenchGetNs:
+ **/
+static uint64_t
+CHugBenchGetNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * CHugBenchCommands:
+ *
+ * Commands that take no simulated cycles are only shown with the host
+ * time, and are not added to the results.
+ *
+ * Returns: %false if a command did not get a reply
+ **/
+static bool
+CHugBenchCommands(void)
+{
+	const ChBenchCommand *cmd;
+	uint32_t cycles;
+	uint64_t ns;
+	uint8_t reply[CH_USB_HID_EP_SIZE];
+	uint8_t i;
+
+	printf("%-20s %12s %12s\n", "command", "cycles", "host ns");
+	for (cmd = bench_cmds; cmd->name != NULL; cmd++) {
+		cycles = 0;
+		ns = CHugBenchGetNs();
+		for (i = 0; i < CH_BENCH_REPEAT; i++) {
+			if (CHugHostCommandSimple(cmd->cmd, cmd->data,
+						  cmd->len, reply) < 0) {
+				fprintf(stderr, "no reply to %s\n", cmd->name);
+				return false;
+			}
+			if (CHugHostGetProcessCycles() > cycles)
+				cycles = CHugHostGetProcessCycles();
+		}
+		ns = (CHugBenchGetNs() - ns) / CH_BENCH_REPEAT;
+		if (cycles == 0) {
+			printf("%-20s %12s %12u\n", cmd->name, "-", (uint32_t) ns);
+			continue;
+		}
+		printf("%-20s %12u %12u\n", cmd->name, cycles, (uint32_t) ns);
+		CHugBenchAddResult(cmd->name, cycles);
+	}
+	return true;
+}
+
+/**
+ * CHugBenchFlash:
+ *
+ * Times the flash functions directly, on the fault log row.
+ **/
+static void
+CHugBenchFlash(void)
+{
+	uint64_t start;
+	uint8_t data[CH_FLASH_WRITE_BLOCK_SIZE];
+	uint8_t i;
+
+	memset (data, 0x00, sizeof(data));
+
+	start = CHugHostGetCycles();
+	CHugFlashErase(CH_EEPROM_ADDR_FAULT_LOG, CH_FLASH_ERASE_BLOCK_SIZE);
+	CHugBenchAddResult("flash-erase", CHugHostGetCycles() - start);
+
+	start = CHugHostGetCycles();
+	CHugFlashWrite(CH_EEPROM_ADDR_FAULT_LOG, sizeof(data), data);
+	CHugBenchAddResult("flash-write", CHugHostGetCycles() - start);
+
+	CHugFlashErase(CH_EEPROM_ADDR_FAULT_LOG, CH_FLASH_ERASE_BLOCK_SIZE);
+
+	for (i = bench_results_len - 2; i < bench_results_len; i++)
+		printf("%-20s %12u\n", bench_results[i].name, bench_results[i].value);
+}
+
+/**
+ * CHugBenchReadingIsCorrect:
+ * @hz: the sensor output frequency
+ * @edges_per_cycle: 2 if both edges are being counted
+ *
+ * Takes a reading and checks the count against the number of edges the
+ * sensor made in the time between the start and end timestamps.
+ **/
+static bool
+CHugBenchReadingIsCorrect(uint32_t hz, uint8_t edges_per_cycle)
+{
+	int32_t duration;
+	uint16_t start_frame, start_offset, end_frame, end_offset;
+	uint32_t count;
+	uint32_t expected;
+	uint32_t error;
+	uint8_t reply[CH_USB_HID_EP_SIZE];
+
+	CHugHostSetSensorFrequency(CH_COLOR_SELECT_WHITE, hz);
+	if (CHugHostCommandSimple(CH_CMD_TAKE_READING_RAW, NULL, 0, reply) != CH_ERROR_NONE)
+		return false;
+	memcpy (&count, &reply[CH_BUFFER_OUTPUT_DATA + 0], 4);
+	memcpy (&start_frame, &reply[CH_BUFFER_OUTPUT_DATA + 4], 2);
+	memcpy (&start_offset, &reply[CH_BUFFER_OUTPUT_DATA + 6], 2);
+	memcpy (&end_frame, &reply[CH_BUFFER_OUTPUT_DATA + 8], 2);
+	memcpy (&end_offset, &reply[CH_BUFFER_OUTPUT_DATA + 10], 2);
+	duration = ((end_frame - start_frame) & CH_USB_FRAME_MASK) * 1000;
+	duration += end_offset - start_offset;
+	expected = (uint64_t) hz * edges_per_cycle * duration / 1000000;
+	error = expected * CH_BENCH_FREQ_ERROR_PERCENT / 100 + 2;
+	return count + error >= expected && count <= expected + error;
+}
+
+/**
+ * CHugBenchCheckFrequency:
+ * @edge_mode: a #ChEdgeMode
+ *
+ * Checks white readings are right at fractions of CH_EDGE_MAX_FREQUENCY
+ * up to the maximum itself.
+ *
+ * Returns: %false if any reading was wrong
+ **/
+static bool
+CHugBenchCheckFrequency(uint8_t edge_mode)
+{
+	const uint8_t color = CH_COLOR_SELECT_WHITE;
+	const uint8_t multiplier = CH_FREQ_SCALE_100;
+	const uint16_t integral_time = 0x1000;
+	uint32_t hz;
+	uint8_t edges_per_cycle = edge_mode == CH_EDGE_MODE_BOTH ? 2 : 1;
+	uint8_t reply[CH_USB_HID_EP_SIZE];
+	uint32_t j;
+	uint8_t i;
+
+	/* a flash stall holds off the SOF interrupt, so the first SOF
+	 * after one is seen late and gives the wrong offset; let a whole
+	 * frame pass before timing readings against the SOFs */
+	for (j = 0; j <= CH_HOST_CYCLES_PER_MS / CH_HOST_CYCLES_PER_LOOP; j++)
+		CHugHostRunLoop();
+
+	CHugHostCommandSimple(CH_CMD_SET_COLOR_SELECT, &color, 1, reply);
+	CHugHostCommandSimple(CH_CMD_SET_MULTIPLIER, &multiplier, 1, reply);
+	CHugHostCommandSimple(CH_CMD_SET_INTEGRAL_TIME, &integral_time, 2, reply);
+	CHugHostCommandSimple(CH_CMD_SET_EDGE_MODE, &edge_mode, 1, reply);
+	for (i = 1; i <= CH_BENCH_FREQ_STEPS; i++) {
+		hz = (uint32_t) CH_EDGE_MAX_FREQUENCY * i / CH_BENCH_FREQ_STEPS;
+		if (!CHugBenchReadingIsCorrect(hz, edges_per_cycle)) {
+			fprintf(stderr, "%uHz is not counted correctly%s\n", hz,
+				edge_mode == CH_EDGE_MODE_BOTH ? " with both edges" : "");
+			return false;
+		}
+	}
+	printf("counted correctly up to %uHz%s\n", CH_EDGE_MAX_FREQUENCY,
+	       edge_mode == CH_EDGE_MODE_BOTH ? " with both edges" : "");
+	return true;
+}
+
+/**
+ * CHugBenchCompare:
+ * @filename: the baseline to compare with
+ *
+ * Returns: the number of results that are worse than the baseline
+ **/
+static int
+CHugBenchCompare(const char *filename)
+{
+	char name[32];
+	FILE *f;
+	int regressions = 0;
+	uint32_t baseline;
+	uint32_t limit;
+	uint8_t i;
+
+	f = fopen(filename, "r");
+	if (f == NULL) {
+		fprintf(stderr, "failed to open %s\n", filename);
+		return 1;
+	}
+	while (fscanf(f, "%31s %u", name, &baseline) == 2) {
+		for (i = 0; i < bench_results_len; i++) {
+			if (strcmp(bench_results[i].name, name) == 0)
+				break;
+		}
+		if (i == bench_results_len) {
+			fprintf(stderr, "%s: not measured\n", name);
+			regressions++;
+			continue;
+		}
+		limit = baseline + baseline * CH_BENCH_THRESHOLD_PERCENT / 100;
+		limit += CH_BENCH_THRESHOLD_CYCLES;
+		if (bench_results[i].value <= limit)
+			continue;
+		fprintf(stderr, "%s: %u, baseline %u\n",
+			name, bench_results[i].value, baseline);
+		regressions++;
+	}
+	fclose(f);
+	return regressions;
+}
+
+/**
+ * CHugBenchSave:
+ **/
+static int
+CHugBenchSave(const char *filename)
+{
+	FILE *f;
+	uint8_t i;
+
+	f = fopen(filename, "w");
+	if (f == NULL) {
+		fprintf(stderr, "failed to open %s\n", filename);
+		return 1;
+	}
+	for (i = 0; i < bench_results_len; i++)
+		fprintf(f, "%s %u\n", bench_results[i].name, bench_results[i].value);
+	fclose(f);
+	return 0;
+}
+
+/**
+ * CHugBench:
+ * @baseline: the file of results to compare with, or %NULL
+ * @update: write the results to @baseline rather than comparing
+ *
+ * Returns: an exit code, which is a failure if anything regressed
+ **/
+int
+CHugBench(const char *baseline, bool update)
+{
+	int regressions;
+
+	CHugHostStart();
+	if (!CHugBenchCommands())
+		return EXIT_FAILURE;
+	CHugBenchFlash();
+	if (!CHugBenchCheckFrequency(CH_EDGE_MODE_RISING) ||
+	    !CHugBenchCheckFrequency(CH_EDGE_MODE_BOTH))
+		return EXIT_FAILURE;
+
+	if (baseline == NULL)
+		return EXIT_SUCCESS;
+	if (update)
+		return CHugBenchSave(baseline) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+	regressions = CHugBenchCompare(baseline);
+	if (regressions > 0) {
+		fprintf(stderr, "%i results are worse than %s\n",
+			regressions, baseline);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,422 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "ColorHug.h"
+
+#include "ch-common.h"
+#include "ch-hal.h"
+#include "ch-hal-host.h"
+
+#include <stdbool.h>
+
+#define	CH_HOST_SFR_DEFINE(name)					\
+	volatile uint8_t name;						\
+	volatile ChHostBits name##bits;
+
+CH_HOST_SFR_DEFINE(PORTA)	CH_HOST_SFR_DEFINE(PORTC)
+CH_HOST_SFR_DEFINE(LATA)	CH_HOST_SFR_DEFINE(LATC)
+CH_HOST_SFR_DEFINE(TRISA)	CH_HOST_SFR_DEFINE(TRISC)
+CH_HOST_SFR_DEFINE(ANSELA)	CH_HOST_SFR_DEFINE(ANSELC)
+CH_HOST_SFR_DEFINE(WPUA)	CH_HOST_SFR_DEFINE(PMCON1)
+CH_HOST_SFR_DEFINE(PMCON2)	CH_HOST_SFR_DEFINE(PMDATL)
+CH_HOST_SFR_DEFINE(PMDATH)	CH_HOST_SFR_DEFINE(PMADRL)
+CH_HOST_SFR_DEFINE(PMADRH)	CH_HOST_SFR_DEFINE(UCON)
+CH_HOST_SFR_DEFINE(UCFG)	CH_HOST_SFR_DEFINE(UIR)
+CH_HOST_SFR_DEFINE(UIE)		CH_HOST_SFR_DEFINE(UFRMH)
+CH_HOST_SFR_DEFINE(UFRML)	CH_HOST_SFR_DEFINE(OSCCON)
+CH_HOST_SFR_DEFINE(OSCSTAT)	CH_HOST_SFR_DEFINE(ACTCON)
+CH_HOST_SFR_DEFINE(PCON)	CH_HOST_SFR_DEFINE(WDTCON)
+CH_HOST_SFR_DEFINE(STATUS)	CH_HOST_SFR_DEFINE(STKPTR)
+CH_HOST_SFR_DEFINE(TOSL)	CH_HOST_SFR_DEFINE(TOSH)
+CH_HOST_SFR_DEFINE(INTCON)	CH_HOST_SFR_DEFINE(PIR1)
+CH_HOST_SFR_DEFINE(PIE1)	CH_HOST_SFR_DEFINE(PIR2)
+CH_HOST_SFR_DEFINE(PIE2)	CH_HOST_SFR_DEFINE(T1CON)
+CH_HOST_SFR_DEFINE(TMR1L)	CH_HOST_SFR_DEFINE(TMR1H)
+CH_HOST_SFR_DEFINE(T2CON)	CH_HOST_SFR_DEFINE(TMR2)
+CH_HOST_SFR_DEFINE(PR2)		CH_HOST_SFR_DEFINE(IOCAP)
+CH_HOST_SFR_DEFINE(IOCAN)	CH_HOST_SFR_DEFINE(IOCAF)
+CH_HOST_SFR_DEFINE(FVRCON)	CH_HOST_SFR_DEFINE(ADCON0)
+CH_HOST_SFR_DEFINE(ADCON1)	CH_HOST_SFR_DEFINE(ADCON2)
+CH_HOST_SFR_DEFINE(ADRESL)	CH_HOST_SFR_DEFINE(ADRESH)
+
+volatile uint16_t PMADR;
+
+/* simulated time, in instruction cycles */
+static uint64_t		host_cycles = 0;
+static uint16_t		host_tmr1 = 0;
+static uint8_t		host_cycles_per_read = CH_HOST_CYCLES_PER_READ_DEFAULT;
+static uint8_t		host_resets = 0;
+
+/* the TCS3200 output frequency at 100%, indexed by ChColorSelect */
+static uint32_t		host_sensor_hz[4];
+
+/* the die temperature, in 1/100 degrees C */
+static int16_t		host_temperature;
+static uint16_t		host_vdd;
+
+static uint16_t		host_flash[CH_HOST_FLASH_WORDS];
+static bool		host_in_isr = false;
+
+/* provided by the firmware */
+void			ISRCode(void);
+
+/**
+ * CHugHostInit:
+ *
+ * Puts the simulated device into the state it has at power on, with an
+ * erased flash and a sensor looking at a dim grey patch.
+ **/
+void
+CHugHostInit(void)
+{
+	uint16_t i;
+
+	host_cycles = 0;
+	host_tmr1 = 0;
+	host_cycles_per_read = CH_HOST_CYCLES_PER_READ_DEFAULT;
+	host_resets = 0;
+	host_sensor_hz[CH_COLOR_SELECT_RED] = 60000;
+	host_sensor_hz[CH_COLOR_SELECT_WHITE] = 150000;
+	host_sensor_hz[CH_COLOR_SELECT_BLUE] = 50000;
+	host_sensor_hz[CH_COLOR_SELECT_GREEN] = 55000;
+	host_temperature = 2500;
+	host_vdd = 5000;
+	for (i = 0; i < CH_HOST_FLASH_WORDS; i++)
+		host_flash[i] = CH_HOST_FLASH_ERASED;
+	PCON = 0x1f;
+	PCONbits.nRWDT = 1;
+	PCONbits.nRI = 1;
+	PCONbits.nPOR = 1;
+	PCONbits.nBOR = 1;
+	OSCSTATbits.PLLRDY = 1;
+}
+
+/**
+ * CHugHostInterrupt:
+ *
+ * Runs the ISR if an enabled interrupt is pending, as the device would
+ * between any two instructions.
+ **/
+static void
+CHugHostInterrupt(void)
+{
+	if (!INTCONbits.GIE || host_in_isr)
+		return;
+	if (!(PIE1bits.TMR1IE && PIR1bits.TMR1IF) &&
+	    !(PIE1bits.TMR2IE && PIR1bits.TMR2IF) &&
+	    !(PIE2bits.USBIE && PIR2bits.USBIF))
+		return;
+	host_in_isr = true;
+	INTCONbits.GIE = 0;
+	ISRCode();
+	INTCONbits.GIE = 1;
+	host_in_isr = false;
+}
+
+/**
+ * CHugHostAdvance:
+ * @cycles: the number of instruction cycles that have passed
+ *
+ * Moves simulated time on, updating the timers and the USB frame number.
+ **/
+void
+CHugHostAdvance(uint32_t cycles)
+{
+	uint64_t old = host_cycles;
+	uint16_t frame;
+
+	host_cycles += cycles;
+
+	/* Timer1 counts the instruction clock */
+	if (T1CONbits.TMR1ON) {
+		if ((uint32_t) host_tmr1 + cycles > 0xffff)
+			PIR1bits.TMR1IF = 1;
+		host_tmr1 += cycles;
+		TMR1H = host_tmr1 >> 8;
+		TMR1L = host_tmr1 & 0xff;
+	}
+
+	/* Timer2 is only ever used as the millisecond tick */
+	if (T2CONbits.TMR2ON &&
+	    old / CH_HOST_CYCLES_PER_MS != host_cycles / CH_HOST_CYCLES_PER_MS)
+		PIR1bits.TMR2IF = 1;
+
+	/* full speed frames are 1ms, and each starts with a SOF */
+	frame = (host_cycles / CH_HOST_CYCLES_PER_MS) & CH_USB_FRAME_MASK;
+	if (frame != (((uint16_t) UFRMH << 8) | UFRML))
+		PIR2bits.USBIF = 1;
+	UFRMH = frame >> 8;
+	UFRML = frame & 0xff;
+
+	CHugHostInterrupt();
+}
+
+/**
+ * CHugHostGetCycles:
+ **/
+uint64_t
+CHugHostGetCycles(void)
+{
+	return host_cycles;
+}
+
+/**
+ * CHugHostSetCyclesPerRead:
+ * @cycles: how long each read of PORTA takes
+ **/
+void
+CHugHostSetCyclesPerRead(uint8_t cycles)
+{
+	host_cycles_per_read = cycles;
+}
+
+/**
+ * CHugHostSetSensorFrequency:
+ * @color_select: a #ChColorSelect
+ * @hz: the output frequency at the 100% scale
+ **/
+void
+CHugHostSetSensorFrequency(uint8_t color_select, uint32_t hz)
+{
+	host_sensor_hz[color_select & 0x03] = hz;
+}
+
+/**
+ * CHugHostGetSensorFrequency:
+ * @color_select: a #ChColorSelect
+ *
+ * Returns: the output frequency at the 100% scale
+ **/
+uint32_t
+CHugHostGetSensorFrequency(uint8_t color_select)
+{
+	return host_sensor_hz[color_select & 0x03];
+}
+
+/**
+ * CHugHostGetSensorLevel:
+ *
+ * The TCS3200 output is a square wave with a 50% duty cycle, which is
+ * held low when the sensor is powered down.
+ **/
+static uint8_t
+CHugHostGetSensorLevel(void)
+{
+	uint64_t hz = host_sensor_hz[CHugGetColorSelect()];
+
+	switch (CHugGetMultiplier()) {
+	case CH_FREQ_SCALE_0:
+		return 0;
+	case CH_FREQ_SCALE_2:
+		hz /= 50;
+		break;
+	case CH_FREQ_SCALE_20:
+		hz /= 5;
+		break;
+	default:
+		break;
+	}
+	return ((host_cycles * hz * 2) / (CH_HOST_CYCLES_PER_MS * 1000)) & 0x01;
+}
+
+/**
+ * CHugHalReadPortA:
+ **/
+uint8_t
+CHugHalReadPortA(void)
+{
+	CHugHostAdvance(host_cycles_per_read);
+	return (PORTAbits.RA5 << 5) | (CHugHostGetSensorLevel() << 4);
+}
+
+/**
+ * CHugHalSampleSensor:
+ * @cycles: the instruction cycles taken by each sample
+ **/
+uint8_t
+CHugHalSampleSensor(uint8_t cycles)
+{
+	CHugHostAdvance(cycles);
+	return CHugHostGetSensorLevel();
+}
+
+/**
+ * CHugHostSetTemperature:
+ * @temperature: the die temperature in 1/100 degrees C
+ **/
+void
+CHugHostSetTemperature(int16_t temperature)
+{
+	host_temperature = temperature;
+}
+
+/**
+ * CHugHostSetVdd:
+ * @vdd: the supply voltage in mV, which the ADC uses as its reference
+ **/
+void
+CHugHostSetVdd(uint16_t vdd)
+{
+	host_vdd = vdd;
+}
+
+/**
+ * CHugHalAdcConvert:
+ *
+ * Converts the temperature indicator in its high range or the 1.024V
+ * output of FVR buffer 1, which are the only inputs connected in the
+ * simulation.
+ **/
+void
+CHugHalAdcConvert(void)
+{
+	double vdd = host_vdd / 1000.f;
+	double vt;
+	uint16_t adc = 0;
+
+	CHugHostAdvance(CH_HOST_ADC_CYCLES);
+	if (ADCON0bits.ADON && ADCON0bits.CHS == 0b11101 &&
+	    FVRCONbits.TSEN && FVRCONbits.TSRNG) {
+		vt = 0.659 - (host_temperature / 100.f + 40) * 0.00132;
+		adc = (vdd - 4 * vt) / vdd * 1023 + 0.5;
+	}
+	if (ADCON0bits.ADON && ADCON0bits.CHS == 0b11111 &&
+	    FVRCONbits.FVREN && FVRCONbits.ADFVR == 0b01)
+		adc = 1.024 / vdd * 1023 + 0.5;
+	ADRESH = adc >> 8;
+	ADRESL = adc & 0xff;
+}
+
+/**
+ * CHugHalFlashStart:
+ *
+ * Erases the row or writes the word set up in PMCON1. The lower half of
+ * the flash is write protected, as with the WRT_HALF configuration.
+ **/
+void
+CHugHalFlashStart(void)
+{
+	uint16_t addr = PMADR & (CH_HOST_FLASH_WORDS - 1);
+	uint16_t i;
+
+	if (!PMCON1bits.WREN || PMCON1bits.CFGS) {
+		PMCON1bits.WRERR = 1;
+		return;
+	}
+	CHugHostAdvance(CH_HOST_FLASH_CYCLES);
+	if (addr < CH_HOST_FLASH_WORDS / 2)
+		return;
+
+	/* erase the whole row */
+	if (PMCON1bits.FREE) {
+		addr &= ~(CH_HOST_FLASH_ROW_WORDS - 1);
+		for (i = 0; i < CH_HOST_FLASH_ROW_WORDS; i++)
+			host_flash[addr + i] = CH_HOST_FLASH_ERASED;
+		return;
+	}
+
+	/* programming can only clear bits */
+	host_flash[addr] &= ((uint16_t) (PMDATH & 0x3f) << 8) | PMDATL;
+}
+
+/**
+ * CHugHalFlashRead:
+ **/
+void
+CHugHalFlashRead(void)
+{
+	uint16_t value = CHugHostFlashGetWord(PMADR);
+
+	PMDATL = value & 0xff;
+	PMDATH = value >> 8;
+}
+
+/**
+ * CHugHalSetGie:
+ **/
+void
+CHugHalSetGie(uint8_t gie)
+{
+	INTCONbits.GIE = gie;
+	CHugHostInterrupt();
+}
+
+/**
+ * CHugHostFlashGetWord:
+ * @addr: the address in words
+ **/
+uint16_t
+CHugHostFlashGetWord(uint16_t addr)
+{
+	return host_flash[addr & (CH_HOST_FLASH_WORDS - 1)];
+}
+
+/**
+ * CHugHostFlashSetWord:
+ * @addr: the address in words
+ * @value: the 14 bit value, ignoring any write protection
+ **/
+void
+CHugHostFlashSetWord(uint16_t addr, uint16_t value)
+{
+	host_flash[addr & (CH_HOST_FLASH_WORDS - 1)] = value & 0x3fff;
+}
+
+/**
+ * CHugHostReset:
+ *
+ * There is no way to restart the program, so the reset is only counted
+ * and the caller carries on.
+ **/
+void
+CHugHostReset(void)
+{
+	host_resets++;
+	PCONbits.nRI = 0;
+}
+
+/**
+ * CHugHostGetResetCount:
+ **/
+uint8_t
+CHugHostGetResetCount(void)
+{
+	return host_resets;
+}
+
+/**
+ * CHugHostSleep:
+ *
+ * Nothing can wake the simulated device, so sleep for a frame. The
+ * timers count the instruction clock and so stop while asleep.
+ **/
+void
+CHugHostSleep(void)
+{
+	uint8_t tmr1on = T1CONbits.TMR1ON;
+	uint8_t tmr2on = T2CONbits.TMR2ON;
+
+	T1CONbits.TMR1ON = 0;
+	T2CONbits.TMR2ON = 0;
+	CHugHostAdvance(CH_HOST_CYCLES_PER_MS);
+	T1CONbits.TMR1ON = tmr1on;
+	T2CONbits.TMR2ON = tmr2on;
+}
@@ -0,0 +1,60 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __CH_HAL_HOST_H
+#define __CH_HAL_HOST_H
+
+#include <stdint.h>
+
+/* the instruction clock of the simulated device */
+#define	CH_HOST_CYCLES_PER_MS			12000
+
+/* roughly what a pass of a C loop reading PORTA costs */
+#define	CH_HOST_CYCLES_PER_READ_DEFAULT		8
+
+/* the program flash, in 14 bit words */
+#define	CH_HOST_FLASH_WORDS			0x2000
+#define	CH_HOST_FLASH_ROW_WORDS			32
+#define	CH_HOST_FLASH_ERASED			0x3fff
+
+/* a flash erase or write stalls the CPU for about 2ms */
+#define	CH_HOST_FLASH_CYCLES			(2 * CH_HOST_CYCLES_PER_MS)
+
+/* an ADC conversion takes 11.5 periods of Fosc/64 */
+#define	CH_HOST_ADC_CYCLES			184
+
+void		 CHugHostInit		(void);
+void		 CHugHostAdvance	(uint32_t	 cycles);
+uint64_t	 CHugHostGetCycles	(void);
+void		 CHugHostSetCyclesPerRead (uint8_t	 cycles);
+void		 CHugHostSetSensorFrequency (uint8_t	 color_select,
+					 uint32_t	 hz);
+uint32_t	 CHugHostGetSensorFrequency (uint8_t	 color_select);
+void		 CHugHostSetTemperature	(int16_t	 temperature);
+void		 CHugHostSetVdd		(uint16_t	 vdd);
+uint16_t	 CHugHostFlashGetWord	(uint16_t	 addr);
+void		 CHugHostFlashSetWord	(uint16_t	 addr,
+					 uint16_t	 value);
+void		 CHugHostReset		(void);
+void		 CHugHostSleep		(void);
+uint8_t		 CHugHostGetResetCount	(void);
+
+#endif /* __CH_HAL_HOST_H */
@@ -0,0 +1,1132 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Runs the firmware on the host against a simulated sensor, flash and
+ * USB bus, which allows the command handling and the acquisition and
+ * flash paths to be exercised and profiled without any hardware.
+ *
+ * The firmware is included rather than linked so that the static
+ * functions can be called directly.
+ */
+
+#define	main	CHugFirmwareMain
+#include "firmware.c"
+#undef	main
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "ch-bench.h"
+#include "ch-hal-host.h"
+#include "ch-host.h"
+#include "ch-usb-host.h"
+
+/**
+ * CHugHostStart:
+ *
+ * Powers on the simulated device and configures it.
+ **/
+void
+CHugHostStart(void)
+{
+	CHugHostInit();
+	CHugInit();
+	CHugHostUsbConfigure();
+}
+
+/**
+ * CHugHostRunLoop:
+ **/
+void
+CHugHostRunLoop(void)
+{
+	CHugHostAdvance(CH_HOST_CYCLES_PER_LOOP);
+	CHugTasks();
+}
+
+/**
+ * CHugHostCommand:
+ * @req: the 64 byte request
+ * @reply: the 64 byte reply
+ *
+ * Sends a request on the HID endpoint and waits for the reply.
+ *
+ * Returns: the return code from the reply, or -1 if there was none
+ **/
+int
+CHugHostCommand(const uint8_t *req, uint8_t *reply)
+{
+	uint32_t i;
+
+	for (i = 0; i < CH_HOST_MAX_LOOPS; i++) {
+		if (CHugHostUsbWrite(HID_EP, req, CH_USB_HID_EP_SIZE))
+			break;
+		CHugHostRunLoop();
+	}
+	for (i = 0; i < CH_HOST_MAX_LOOPS; i++) {
+		CHugHostRunLoop();
+		if (CHugHostUsbRead(HID_EP, reply, CH_USB_HID_EP_SIZE) > 0)
+			return reply[CH_BUFFER_OUTPUT_RETVAL];
+	}
+	return -1;
+}
+
+/**
+ * CHugHostCommandSimple:
+ * @cmd: the command
+ * @data: the request data, or %NULL
+ * @len: the size of @data
+ * @reply: the 64 byte reply
+ **/
+int
+CHugHostCommandSimple(uint8_t cmd, const void *data, uint8_t len, uint8_t *reply)
+{
+	uint8_t req[CH_USB_HID_EP_SIZE];
+
+	memset (req, 0x00, sizeof(req));
+	req[CH_BUFFER_INPUT_CMD] = cmd;
+	if (data != NULL)
+		memcpy (&req[CH_BUFFER_INPUT_DATA], data, len);
+	return CHugHostCommand(req, reply);
+}
+
+/**
+ * CHugHostGetProcessCycles:
+ *
+ * Returns: the cycles spent handling the last command on the HID endpoint
+ **/
+uint32_t
+CHugHostGetProcessCycles(void)
+{
+	return process_cycles;
+}
+
+/**
+ * CHugHostFrequencyIsClose:
+ *
+ * The self test measures to 10Hz, and the sensor scaling is only
+ * accurate to a few percent.
+ **/
+static bool
+CHugHostFrequencyIsClose(uint32_t hz, uint32_t expected)
+{
+	uint32_t error = expected * 3 / 100 + 20;
+
+	return hz + error >= expected && hz <= expected + error;
+}
+
+/**
+ * CHugHostFlashCrc:
+ *
+ * Returns: the CRC-16/CCITT the self test should find for the image
+ **/
+static uint16_t
+CHugHostFlashCrc(void)
+{
+	uint16_t addr;
+	uint16_t crc = 0xffff;
+	uint16_t word;
+	uint8_t i;
+	uint8_t j;
+
+	for (addr = CH_EEPROM_ADDR_RUNCODE / 2;
+	     addr < CH_EEPROM_ADDR_FAULT_LOG / 2;
+	     addr++) {
+		word = CHugHostFlashGetWord(addr);
+		for (i = 0; i < 2; i++) {
+			crc ^= (uint16_t) ((word >> (i * 8)) & 0xff) << 8;
+			for (j = 0; j < 8; j++) {
+				if (crc & 0x8000)
+					crc = (crc << 1) ^ 0x1021;
+				else
+					crc <<= 1;
+			}
+		}
+	}
+	return crc;
+}
+
+/**
+ * CHugHostRunFor:
+ * @ms: the simulated time to run the main loop for
+ **/
+static void
+CHugHostRunFor(uint32_t ms)
+{
+	uint32_t i;
+
+	for (i = 0; i < ms * CH_HOST_CYCLES_PER_MS / CH_HOST_CYCLES_PER_LOOP; i++)
+		CHugHostRunLoop();
+}
+
+/* the color names, in CH_COLOR_SELECT order */
+static const char *host_colors[] = { "red", "white", "blue", "green" };
+
+/* the integral time used for the readings, which can be set on the
+ * command line */
+static uint16_t host_integral_time = 0xffff;
+
+/**
+ * CHugHostTestVersion:
+ **/
+static bool
+CHugHostTestVersion(void)
+{
+	uint8_t reply[CH_USB_HID_EP_SIZE];
+	int rc;
+
+	rc = CHugHostCommandSimple(CH_CMD_GET_FIRMWARE_VERSION, NULL, 0, reply);
+	if (rc != CH_ERROR_NONE) {
+		fprintf(stderr, "failed to get version: %i\n", rc);
+		return false;
+	}
+	printf("firmware %u.%u.%u\n",
+	       reply[CH_BUFFER_OUTPUT_DATA + 0],
+	       reply[CH_BUFFER_OUTPUT_DATA + 2],
+	       reply[CH_BUFFER_OUTPUT_DATA + 4]);
+	return true;
+}
+
+/**
+ * CHugHostFeatureSetup:
+ **/
+static void
+CHugHostFeatureSetup(CTRL_TRF_SETUP *setup, uint8_t request, uint8_t dir)
+{
+	memset (setup, 0x00, sizeof(CTRL_TRF_SETUP));
+	setup->Recipient = USB_SETUP_RECIPIENT_INTERFACE_BITFIELD;
+	setup->RequestType = USB_SETUP_TYPE_CLASS_BITFIELD;
+	setup->DataDir = dir;
+	setup->bRequest = request;
+	setup->bIntfID = HID_INTF_ID;
+	setup->W_Value.byte.HB = CH_HID_REPORT_TYPE_FEATURE;
+	setup->wLength = CH_USB_HID_EP_SIZE;
+}
+
+/**
+ * CHugHostTestFeatureReport:
+ *
+ * Checks a command can be run with SET_REPORT and its reply read with
+ * GET_REPORT, and that the status stage is held off until the main
+ * loop has run the command.
+ **/
+static bool
+CHugHostTestFeatureReport(void)
+{
+	CTRL_TRF_SETUP setup;
+	uint8_t report[CH_USB_HID_EP_SIZE];
+	int len;
+
+	memset (report, 0x00, sizeof(report));
+	report[CH_BUFFER_INPUT_CMD] = CH_CMD_SET_COLOR_SELECT;
+	report[CH_BUFFER_INPUT_DATA] = CH_COLOR_SELECT_BLUE;
+	CHugHostFeatureSetup(&setup, SET_REPORT,
+			     USB_SETUP_HOST_TO_DEVICE_BITFIELD);
+	len = CHugHostUsbControl(&setup, report, sizeof(report));
+	if (len != CH_USB_HID_EP_SIZE || CHugHostUsbControlStatusDone()) {
+		fprintf(stderr, "SET_REPORT status stage was not held off\n");
+		return false;
+	}
+	CHugHostRunLoop();
+	if (!CHugHostUsbControlStatusDone()) {
+		fprintf(stderr, "SET_REPORT status stage was not completed\n");
+		return false;
+	}
+
+	CHugHostFeatureSetup(&setup, GET_REPORT,
+			     USB_SETUP_DEVICE_TO_HOST_BITFIELD);
+	len = CHugHostUsbControl(&setup, report, sizeof(report));
+	if (len == -2) {
+		CHugHostRunLoop();
+		len = CHugHostUsbControlIn(report, sizeof(report));
+	}
+	printf("feature report reply %i for command 0x%02x, color %u\n",
+	       report[CH_BUFFER_OUTPUT_RETVAL],
+	       report[CH_BUFFER_OUTPUT_CMD],
+	       CHugGetColorSelect());
+	if (len != CH_USB_HID_EP_SIZE ||
+	    report[CH_BUFFER_OUTPUT_RETVAL] != CH_ERROR_NONE ||
+	    report[CH_BUFFER_OUTPUT_CMD] != CH_CMD_SET_COLOR_SELECT ||
+	    CHugGetColorSelect() != CH_COLOR_SELECT_BLUE) {
+		fprintf(stderr, "failed to run command using feature reports\n");
+		return false;
+	}
+	return true;
+}
+
+/**
+ * CHugHostFeatureCommand:
+ * @report: the 64 byte request, replaced with the reply
+ *
+ * Runs a command with SET_REPORT and reads the reply with GET_REPORT.
+ *
+ * Returns: the length of the reply, or -1 if either request failed
+ **/
+static int
+CHugHostFeatureCommand(uint8_t *report)
+{
+	CTRL_TRF_SETUP setup;
+	int len;
+
+	CHugHostFeatureSetup(&setup, SET_REPORT,
+			     USB_SETUP_HOST_TO_DEVICE_BITFIELD);
+	if (CHugHostUsbControl(&setup, report, CH_USB_HID_EP_SIZE) < 0)
+		return -1;
+	CHugHostRunLoop();
+	CHugHostFeatureSetup(&setup, GET_REPORT,
+			     USB_SETUP_DEVICE_TO_HOST_BITFIELD);
+	len = CHugHostUsbControl(&setup, report, CH_USB_HID_EP_SIZE);
+	if (len != -2)
+		return len;
+	CHugHostRunLoop();
+	return CHugHostUsbControlIn(report, CH_USB_HID_EP_SIZE);
+}
+
+/**
+ * CHugHostTestPing:
+ *
+ * Checks the token is echoed on the endpoint and with feature reports,
+ * where the request and reply share a buffer.
+ **/
+static bool
+CHugHostTestPing(void)
+{
+	const uint32_t token = 0x12345678;
+	uint8_t report[CH_USB_HID_EP_SIZE];
+	uint8_t reply[CH_USB_HID_EP_SIZE];
+	int rc;
+
+	rc = CHugHostCommandSimple(CH_CMD_PING, &token, 4, reply);
+	if (rc != CH_ERROR_NONE ||
+	    memcmp (&reply[CH_BUFFER_OUTPUT_DATA], &token, 4) != 0) {
+		fprintf(stderr, "failed to ping: %i\n", rc);
+		return false;
+	}
+	memset (report, 0x00, sizeof(report));
+	report[CH_BUFFER_INPUT_CMD] = CH_CMD_PING;
+	memcpy (&report[CH_BUFFER_INPUT_DATA], &token, 4);
+	if (CHugHostFeatureCommand(report) != CH_USB_HID_EP_SIZE ||
+	    report[CH_BUFFER_OUTPUT_RETVAL] != CH_ERROR_NONE ||
+	    memcmp (&report[CH_BUFFER_OUTPUT_DATA], &token, 4) != 0) {
+		fprintf(stderr, "failed to ping with feature reports\n");
+		return false;
+	}
+	printf("ping token 0x%08x echoed\n", token);
+	return true;
+}
+
+/**
+ * CHugHostTestStats:
+ *
+ * Checks the command counts stop at 255.
+ **/
+static bool
+CHugHostTestStats(void)
+{
+	uint8_t page[2] = { CH_STATS_PAGE_COMMANDS, CH_STATS_FLAG_RESET };
+	uint8_t reply[CH_USB_HID_EP_SIZE];
+	const uint8_t *entry;
+	uint16_t i;
+
+	for (i = 0; i < 300; i++)
+		CHugHostCommandSimple(CH_CMD_GET_HARDWARE_VERSION, NULL, 0, reply);
+	CHugHostCommandSimple(CH_CMD_GET_STATS, page, 2, reply);
+	for (i = 0; i < CH_STATS_CMDS_PER_PAGE; i++) {
+		entry = &reply[CH_BUFFER_OUTPUT_DATA + i * 2];
+		if (entry[0] == CH_CMD_GET_HARDWARE_VERSION)
+			break;
+	}
+	if (i == CH_STATS_CMDS_PER_PAGE) {
+		fprintf(stderr, "hardware version is not counted\n");
+		return false;
+	}
+	printf("hardware version handled %u times\n", entry[1]);
+	if (entry[1] != 0xff) {
+		fprintf(stderr, "command count did not stop at 255\n");
+		return false;
+	}
+	return true;
+}
+
+/**
+ * CHugHostTestReadings:
+ *
+ * Takes a reading of each color, showing how long it took.
+ **/
+static bool
+CHugHostTestReadings(void)
+{
+	clock_t host_start;
+	uint32_t count;
+	uint64_t sim_start;
+	uint8_t reply[CH_USB_HID_EP_SIZE];
+	uint8_t value;
+	uint8_t i;
+	int rc;
+
+	value = CH_FREQ_SCALE_100;
+	CHugHostCommandSimple(CH_CMD_SET_MULTIPLIER, &value, 1, reply);
+	CHugHostCommandSimple(CH_CMD_SET_INTEGRAL_TIME,
+			      &host_integral_time, 2, reply);
+
+	for (i = 0; i < 4; i++) {
+		CHugHostCommandSimple(CH_CMD_SET_COLOR_SELECT, &i, 1, reply);
+		sim_start = CHugHostGetCycles();
+		host_start = clock();
+		rc = CHugHostCommandSimple(CH_CMD_TAKE_READING_RAW, NULL, 0, reply);
+		if (rc != CH_ERROR_NONE) {
+			fprintf(stderr, "failed to take reading: %i\n", rc);
+			return false;
+		}
+		memcpy (&count, &reply[CH_BUFFER_OUTPUT_DATA], 4);
+		printf("%-5s %10u edges in %.1fms (host %.1fms)\n",
+		       host_colors[i], count,
+		       (double) (CHugHostGetCycles() - sim_start) / CH_HOST_CYCLES_PER_MS,
+		       (double) (clock() - host_start) * 1000.f / CLOCKS_PER_SEC);
+	}
+	return true;
+}
+
+/**
+ * CHugHostTestPowerTimeout:
+ *
+ * Checks the sensor is powered down when idle, and back up on demand.
+ **/
+static bool
+CHugHostTestPowerTimeout(void)
+{
+	uint16_t timeout = 50;
+	uint32_t count;
+	uint8_t reply[CH_USB_HID_EP_SIZE];
+	uint8_t value;
+
+	CHugHostCommandSimple(CH_CMD_SET_POWER_TIMEOUT, &timeout, 2, reply);
+	CHugHostRunFor(timeout + 1);
+	CHugHostCommandSimple(CH_CMD_GET_MULTIPLIER, NULL, 0, reply);
+	value = reply[CH_BUFFER_OUTPUT_DATA];
+	CHugHostCommandSimple(CH_CMD_TAKE_READING_RAW, NULL, 0, reply);
+	memcpy (&count, &reply[CH_BUFFER_OUTPUT_DATA], 4);
+	printf("idle multiplier %u, then %u edges\n", value, count);
+	timeout = CH_SENSOR_POWER_TIMEOUT_DEFAULT;
+	CHugHostCommandSimple(CH_CMD_SET_POWER_TIMEOUT, &timeout, 2, reply);
+	if (value != CH_FREQ_SCALE_0 || count == 0) {
+		fprintf(stderr, "failed to power the sensor up on demand\n");
+		return false;
+	}
+	return true;
+}
+
+/**
+ * CHugHostTestSuspend:
+ *
+ * Checks the device sleeps while suspended and then powers the sensor
+ * back up.
+ **/
+static bool
+CHugHostTestSuspend(void)
+{
+	uint8_t reply[CH_USB_HID_EP_SIZE];
+	uint8_t value;
+	uint8_t i;
+
+	CHugHostUsbSuspend(true);
+	for (i = 0; i < 10; i++)
+		CHugHostRunLoop();
+	CHugHostUsbSuspend(false);
+	CHugHostCommandSimple(CH_CMD_GET_MULTIPLIER, NULL, 0, reply);
+	value = reply[CH_BUFFER_OUTPUT_DATA];
+	printf("slept %u times while suspended, resumed at multiplier %u\n",
+	       stats.sleeps, value);
+	if (stats.sleeps == 0 || value != CH_FREQ_SCALE_100) {
+		fprintf(stderr, "failed to sleep while suspended\n");
+		return false;
+	}
+	return true;
+}
+
+/**
+ * CHugHostTestRemoteWakeup:
+ *
+ * Checks a change in light wakes the host from suspend.
+ **/
+static bool
+CHugHostTestRemoteWakeup(void)
+{
+	ChWakeThreshold threshold;
+	uint8_t reply[CH_USB_HID_EP_SIZE];
+	uint8_t value;
+	uint8_t i;
+	bool ret = true;
+	int rc;
+
+	memset (&threshold, 0x00, sizeof(threshold));
+	threshold.high = 1000;
+	threshold.integral_time = 0x400;
+	rc = CHugHostCommandSimple(CH_CMD_SET_WAKE_THRESHOLD,
+				   &threshold, sizeof(threshold), reply);
+	if (rc != CH_ERROR_NONE) {
+		fprintf(stderr, "failed to set wake threshold: %i\n", rc);
+		return false;
+	}
+	RemoteWakeup = TRUE;
+	CHugHostUsbSuspend(true);
+	for (i = 0; i < 10; i++)
+		CHugHostRunLoop();
+	value = stats.remote_wakeups;
+	CHugHostSetSensorFrequency(CH_COLOR_SELECT_GREEN, 200000);
+	for (i = 0; i < 10; i++)
+		CHugHostRunLoop();
+	printf("woke the host %u times while suspended\n",
+	       stats.remote_wakeups);
+	if (value != 0 || stats.remote_wakeups != 1 || USBSuspendControl) {
+		fprintf(stderr, "failed to wake the host\n");
+		ret = false;
+	}
+	CHugHostUsbSuspend(false);
+	CHugHostSetSensorFrequency(CH_COLOR_SELECT_GREEN, 55000);
+	memset (&threshold, 0x00, sizeof(threshold));
+	CHugHostCommandSimple(CH_CMD_SET_WAKE_THRESHOLD,
+			      &threshold, sizeof(threshold), reply);
+	return ret;
+}
+
+/**
+ * CHugHostTestProgram:
+ *
+ * Checks a program runs on its own and the results are collected.
+ **/
+static bool
+CHugHostTestProgram(void)
+{
+	uint8_t program[13];
+	uint32_t count;
+	uint8_t reply[CH_USB_HID_EP_SIZE];
+	uint8_t value;
+	uint8_t i;
+	int rc;
+
+	memset (program, 0x00, sizeof(program));
+	program[0] = 3;				/* repeat */
+	program[2] = 10;			/* interval */
+	program[4] = 2;				/* steps */
+	program[5] = CH_COLOR_SELECT_RED;
+	program[6] = CH_FREQ_SCALE_100;
+	program[8] = 0x01;
+	program[9] = CH_COLOR_SELECT_BLUE;
+	program[10] = CH_FREQ_SCALE_20;
+	program[12] = 0x01;
+	rc = CHugHostCommandSimple(CH_CMD_SET_PROGRAM, program,
+				   sizeof(program), reply);
+	if (rc != CH_ERROR_NONE) {
+		fprintf(stderr, "failed to set program: %i\n", rc);
+		return false;
+	}
+	value = 1;
+	CHugHostCommandSimple(CH_CMD_RUN_PROGRAM, &value, 1, reply);
+	CHugHostRunFor(100);
+	CHugHostCommandSimple(CH_CMD_GET_PROGRAM_RESULTS, NULL, 0, reply);
+	printf("program state 0x%02x:", reply[CH_BUFFER_OUTPUT_DATA]);
+	for (i = 0; i < reply[CH_BUFFER_OUTPUT_DATA + 1]; i++) {
+		memcpy (&count, &reply[CH_BUFFER_OUTPUT_DATA + 2 + i * 4], 4);
+		printf(" %u", count);
+	}
+	printf("\n");
+	if (reply[CH_BUFFER_OUTPUT_DATA] != 0 ||
+	    reply[CH_BUFFER_OUTPUT_DATA + 1] != 6) {
+		fprintf(stderr, "failed to run program\n");
+		return false;
+	}
+	return true;
+}
+
+/**
+ * CHugHostTestProgramSlow:
+ *
+ * Checks a program or stream with readings longer than the interval is
+ * refused, and that commands are still answered while a program with
+ * long readings runs.
+ **/
+static bool
+CHugHostTestProgramSlow(void)
+{
+	uint8_t program[9];
+	uint8_t stream[3];
+	uint16_t integral_time = 0x2000;
+	uint16_t interval = 72;		/* the reading takes up to 71.7ms */
+	uint64_t start;
+	uint64_t end;
+	uint32_t latency;
+	uint32_t latency_max = 0;
+	uint32_t replies = 0;
+	uint8_t reply[CH_USB_HID_EP_SIZE];
+	uint8_t value;
+	int rc;
+	bool ret = true;
+
+	memset (program, 0x00, sizeof(program));
+	memcpy (&program[2], &interval, 2);
+	program[4] = 1;				/* steps */
+	program[5] = CH_COLOR_SELECT_RED;
+	program[6] = CH_FREQ_SCALE_100;
+	memcpy (&program[7], &integral_time, 2);
+	CHugHostCommandSimple(CH_CMD_SET_PROGRAM, program,
+			      sizeof(program), reply);
+	value = 1;
+	rc = CHugHostCommandSimple(CH_CMD_RUN_PROGRAM, &value, 1, reply);
+	if (rc != CH_ERROR_INVALID_VALUE) {
+		fprintf(stderr, "program with a short interval not refused\n");
+		ret = false;
+	}
+	CHugHostCommandSimple(CH_CMD_SET_INTEGRAL_TIME, &integral_time, 2, reply);
+	memcpy (stream, &interval, 2);
+	stream[2] = 0;
+	rc = CHugHostCommandSimple(CH_CMD_SET_STREAM, stream,
+				   sizeof(stream), reply);
+	integral_time = host_integral_time;
+	CHugHostCommandSimple(CH_CMD_SET_INTEGRAL_TIME, &integral_time, 2, reply);
+	if (rc != CH_ERROR_INVALID_VALUE) {
+		fprintf(stderr, "stream with a short interval not refused\n");
+		CHugHostCommandSimple(CH_CMD_SET_STREAM, NULL, 0, reply);
+		ret = false;
+	}
+
+	/* the command arrives while a reading blocks the main loop */
+	interval++;
+	memcpy (&program[2], &interval, 2);
+	CHugHostCommandSimple(CH_CMD_SET_PROGRAM, program,
+			      sizeof(program), reply);
+	rc = CHugHostCommandSimple(CH_CMD_RUN_PROGRAM, &value, 1, reply);
+	if (rc != CH_ERROR_NONE) {
+		fprintf(stderr, "failed to run program: %i\n", rc);
+		return false;
+	}
+	/* keep the host asking for the whole time the program runs */
+	end = CHugHostGetCycles() + 5 * interval * CH_HOST_CYCLES_PER_MS;
+	while (CHugHostGetCycles() < end) {
+		start = CHugHostGetCycles();
+		rc = CHugHostCommandSimple(CH_CMD_GET_FIRMWARE_VERSION,
+					   NULL, 0, reply);
+		latency = (CHugHostGetCycles() - start) / CH_HOST_CYCLES_PER_MS;
+		if (rc != CH_ERROR_NONE)
+			latency = 0xffffffff;
+		if (latency > latency_max)
+			latency_max = latency;
+		replies++;
+	}
+	CHugHostCommandSimple(CH_CMD_GET_PROGRAM_RESULTS, NULL, 0, reply);
+	printf("%u replies, the slowest in %ums, while the program took "
+	       "%u readings\n", replies, latency_max,
+	       reply[CH_BUFFER_OUTPUT_DATA + 1]);
+	if (latency_max > interval ||
+	    (reply[CH_BUFFER_OUTPUT_DATA] & CH_PROGRAM_STATE_RUNNING) == 0 ||
+	    reply[CH_BUFFER_OUTPUT_DATA + 1] < 5) {
+		fprintf(stderr, "commands held up by the program\n");
+		ret = false;
+	}
+	value = 0;
+	CHugHostCommandSimple(CH_CMD_RUN_PROGRAM, &value, 1, reply);
+	return ret;
+}
+
+/**
+ * CHugHostTestArmedReading:
+ *
+ * Checks an armed reading starts at its frame, and that nothing is
+ * allowed to hold up the main loop until then. A slow output with the
+ * sensor off checks the warm-up is over before the frame.
+ **/
+static bool
+CHugHostTestArmedReading(void)
+{
+	uint16_t frame;
+	uint32_t count;
+	uint8_t reply[CH_USB_HID_EP_SIZE];
+	uint8_t value;
+	int rc;
+
+	value = CH_COLOR_SELECT_GREEN;
+	CHugHostCommandSimple(CH_CMD_SET_COLOR_SELECT, &value, 1, reply);
+	value = CH_FREQ_SCALE_0;
+	CHugHostCommandSimple(CH_CMD_SET_MULTIPLIER, &value, 1, reply);
+	CHugHostSetSensorFrequency(CH_COLOR_SELECT_GREEN, 200);
+	rc = CHugHostCommandSimple(CH_CMD_GET_ARMED_READING, NULL, 0, reply);
+	if (rc != CH_ERROR_NOT_ARMED) {
+		fprintf(stderr, "armed reading was not refused: %i\n", rc);
+		return false;
+	}
+	frame = ((((uint16_t) UFRMH << 8) | UFRML) + 20) & CH_USB_FRAME_MASK;
+	rc = CHugHostCommandSimple(CH_CMD_ARM_READING, &frame, 2, reply);
+	if (rc != CH_ERROR_NONE) {
+		fprintf(stderr, "failed to arm reading: %i\n", rc);
+		return false;
+	}
+	rc = CHugHostCommandSimple(CH_CMD_TAKE_READING_RAW, NULL, 0, reply);
+	if (rc != CH_ERROR_BUSY) {
+		fprintf(stderr, "reading was not refused while armed: %i\n", rc);
+		return false;
+	}
+	CHugHostRunFor(15);
+	if (!sensor_settled || arm_state != CH_ARM_STATE_WAITING) {
+		fprintf(stderr, "sensor did not settle before the frame\n");
+		return false;
+	}
+
+	/* readings start on a rising edge, so use a faster output */
+	CHugHostSetSensorFrequency(CH_COLOR_SELECT_GREEN, 55000);
+	CHugHostRunFor(100);
+	rc = CHugHostCommandSimple(CH_CMD_GET_ARMED_READING, NULL, 0, reply);
+	memcpy (&count, &reply[CH_BUFFER_OUTPUT_DATA], 4);
+	printf("armed reading of %u edges for frame %u started in frame %u\n",
+	       count, frame,
+	       reply[CH_BUFFER_OUTPUT_DATA + 4] |
+	       reply[CH_BUFFER_OUTPUT_DATA + 5] << 8);
+	if (rc != CH_ERROR_NONE || count == 0 ||
+	    memcmp (&reply[CH_BUFFER_OUTPUT_DATA + 4], &frame, 2) != 0) {
+		fprintf(stderr, "failed to take armed reading: %i\n", rc);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * CHugHostTestSelfTest:
+ *
+ * Checks the self test measures each color, and the flash CRC.
+ **/
+static bool
+CHugHostTestSelfTest(void)
+{
+	uint16_t crc;
+	uint32_t count;
+	uint32_t expected;
+	uint32_t scaled;
+	uint8_t reply[CH_USB_HID_EP_SIZE];
+	const uint8_t *hz;
+	uint8_t i;
+	int rc;
+
+	rc = CHugHostCommandSimple(CH_CMD_SELF_TEST, NULL, 0, reply);
+	if (rc != CH_ERROR_NONE) {
+		fprintf(stderr, "failed to self test: %i\n", rc);
+		return false;
+	}
+	for (i = 0; i < 4; i++) {
+		hz = &reply[CH_BUFFER_OUTPUT_DATA + i * 12];
+		memcpy (&count, &hz[(CH_FREQ_SCALE_100 - 1) * 4], 4);
+		printf("%-5s %10uHz at 100%%\n", host_colors[i], count);
+		expected = CHugHostGetSensorFrequency(i);
+		if (!CHugHostFrequencyIsClose(count, expected)) {
+			fprintf(stderr, "%s should be %uHz\n",
+				host_colors[i], expected);
+			return false;
+		}
+
+		/* the 20% and 2% scales are relative to 100% */
+		memcpy (&scaled, &hz[(CH_FREQ_SCALE_20 - 1) * 4], 4);
+		if (!CHugHostFrequencyIsClose(scaled, count / 5)) {
+			fprintf(stderr, "%s is %uHz at 20%%\n",
+				host_colors[i], scaled);
+			return false;
+		}
+		memcpy (&scaled, &hz[(CH_FREQ_SCALE_2 - 1) * 4], 4);
+		if (!CHugHostFrequencyIsClose(scaled, count / 50)) {
+			fprintf(stderr, "%s is %uHz at 2%%\n",
+				host_colors[i], scaled);
+			return false;
+		}
+	}
+	memcpy (&crc, &reply[CH_BUFFER_OUTPUT_DATA + 52], 2);
+	printf("flash crc 0x%04x\n", crc);
+	if (crc != CHugHostFlashCrc()) {
+		fprintf(stderr, "flash crc should be 0x%04x\n", CHugHostFlashCrc());
+		return false;
+	}
+	return true;
+}
+
+/**
+ * CHugHostTestSelfTestPower:
+ *
+ * Checks the self test counts as using the sensor, so it is left
+ * powered up for the idle timeout afterwards.
+ **/
+static bool
+CHugHostTestSelfTestPower(void)
+{
+	uint16_t timeout = 500;
+	uint8_t reply[CH_USB_HID_EP_SIZE];
+	uint8_t after;
+	uint8_t later;
+	uint8_t value = CH_FREQ_SCALE_20;
+
+	CHugHostCommandSimple(CH_CMD_SET_POWER_TIMEOUT, &timeout, 2, reply);
+	CHugHostCommandSimple(CH_CMD_SET_MULTIPLIER, &value, 1, reply);
+	CHugHostCommandSimple(CH_CMD_SELF_TEST, NULL, 0, reply);
+	CHugHostRunFor(timeout / 2);
+	CHugHostCommandSimple(CH_CMD_GET_MULTIPLIER, NULL, 0, reply);
+	after = reply[CH_BUFFER_OUTPUT_DATA];
+	CHugHostRunFor(timeout);
+	CHugHostCommandSimple(CH_CMD_GET_MULTIPLIER, NULL, 0, reply);
+	later = reply[CH_BUFFER_OUTPUT_DATA];
+	printf("multiplier %u after the self test, %u once idle\n",
+	       after, later);
+
+	timeout = CH_SENSOR_POWER_TIMEOUT_DEFAULT;
+	CHugHostCommandSimple(CH_CMD_SET_POWER_TIMEOUT, &timeout, 2, reply);
+	value = CH_FREQ_SCALE_100;
+	CHugHostCommandSimple(CH_CMD_SET_MULTIPLIER, &value, 1, reply);
+	if (after != CH_FREQ_SCALE_20 || later != CH_FREQ_SCALE_0) {
+		fprintf(stderr, "sensor power not restored after self test\n");
+		return false;
+	}
+	return true;
+}
+
+/**
+ * CHugHostTestDarkOffsets:
+ *
+ * Checks the dark offsets are taken off with the aperture covered.
+ **/
+static bool
+CHugHostTestDarkOffsets(void)
+{
+	uint16_t offset;
+	uint32_t corrected;
+	uint32_t count;
+	uint32_t expected;
+	uint8_t reply[CH_USB_HID_EP_SIZE];
+	uint8_t value;
+	uint8_t i;
+	bool ret = true;
+	int rc;
+
+	for (i = 0; i < 4; i++)
+		CHugHostSetSensorFrequency(i, 100);
+	rc = CHugHostCommandSimple(CH_CMD_TAKE_DARK_CALIBRATION, NULL, 0, reply);
+	if (rc != CH_ERROR_NONE) {
+		fprintf(stderr, "failed to take dark calibration: %i\n", rc);
+		return false;
+	}
+	value = CH_FREQ_SCALE_100;
+	CHugHostCommandSimple(CH_CMD_GET_DARK_OFFSETS, &value, 1, reply);
+	expected = ((uint64_t) 100 << CH_DARK_OFFSET_SHIFT) *
+		   CH_EDGE_SAMPLES_PER_INTEGRAL_TIME * CH_EDGE_CYCLES_PER_SAMPLE /
+		   (CH_HOST_CYCLES_PER_MS * 1000);
+	for (i = 0; i < 4; i++) {
+		memcpy (&offset, &reply[CH_BUFFER_OUTPUT_DATA + i * 2], 2);
+		printf("%-5s dark offset %u, expected %u\n",
+		       host_colors[i], offset, expected);
+		if (offset * 100 < expected * 95 || offset * 100 > expected * 105) {
+			fprintf(stderr, "wrong dark offset\n");
+			return false;
+		}
+	}
+	value = 1;
+	CHugHostCommandSimple(CH_CMD_SET_DARK_SUBTRACT, &value, 1, reply);
+	CHugHostCommandSimple(CH_CMD_TAKE_READING_RAW, NULL, 0, reply);
+	memcpy (&count, &reply[CH_BUFFER_OUTPUT_DATA], 4);
+	memcpy (&corrected, &reply[CH_BUFFER_OUTPUT_DATA + 13], 4);
+	printf("dark %u edges, %u corrected\n", count, corrected);
+	value = reply[CH_BUFFER_OUTPUT_DATA + 12];
+	if ((value & CH_READING_FLAG_DARK_SUBTRACTED) == 0 ||
+	    count == 0 || corrected * 10 > count) {
+		fprintf(stderr, "failed to subtract dark offset\n");
+		ret = false;
+	}
+	value = 0;
+	CHugHostCommandSimple(CH_CMD_SET_DARK_SUBTRACT, &value, 1, reply);
+	return ret;
+}
+
+/**
+ * CHugHostTestTempCompensation:
+ *
+ * Checks readings are corrected to the reference temperature.
+ **/
+static bool
+CHugHostTestTempCompensation(void)
+{
+	int16_t coefficients[5];
+	int16_t temperature;
+	uint32_t corrected;
+	uint32_t count;
+	uint32_t expected;
+	uint8_t reply[CH_USB_HID_EP_SIZE];
+	uint8_t value;
+	int rc;
+
+	memset (coefficients, 0x00, sizeof(coefficients));
+	coefficients[CH_COLOR_SELECT_WHITE] = 1000;
+	coefficients[4] = 2500;
+	rc = CHugHostCommandSimple(CH_CMD_SET_TEMP_COEFFICIENTS,
+				   coefficients, sizeof(coefficients), reply);
+	if (rc != CH_ERROR_NONE) {
+		fprintf(stderr, "failed to set temperature coefficients: %i\n", rc);
+		return false;
+	}
+	value = CH_COLOR_SELECT_WHITE;
+	CHugHostCommandSimple(CH_CMD_SET_COLOR_SELECT, &value, 1, reply);
+	CHugHostSetSensorFrequency(CH_COLOR_SELECT_WHITE, 10000);
+	CHugHostSetTemperature(4500);
+	CHugHostCommandSimple(CH_CMD_TAKE_READING_RAW, NULL, 0, reply);
+	memcpy (&count, &reply[CH_BUFFER_OUTPUT_DATA], 4);
+	memcpy (&corrected, &reply[CH_BUFFER_OUTPUT_DATA + 13], 4);
+	memcpy (&temperature, &reply[CH_BUFFER_OUTPUT_DATA + 17], 2);
+	printf("%.2fC %u edges, %u corrected to 25C\n",
+	       temperature / 100.f, count, corrected);
+	expected = count - (int64_t) count * 1000 * (temperature - 2500) / 100000000;
+	value = reply[CH_BUFFER_OUTPUT_DATA + 12];
+	if ((value & CH_READING_FLAG_TEMP_COMPENSATED) == 0 ||
+	    corrected + 2 < expected || corrected > expected + 2) {
+		fprintf(stderr, "failed to compensate, expected %u\n", expected);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * CHugHostTestTempSupply:
+ *
+ * Checks the temperature does not depend on the bus supply, which the
+ * ADC uses as its reference.
+ **/
+static bool
+CHugHostTestTempSupply(void)
+{
+	const uint16_t vdd[] = { 4400, 5000, 5250 };
+	int16_t temperature;
+	uint8_t reply[CH_USB_HID_EP_SIZE];
+	uint8_t i;
+	int rc;
+
+	CHugHostSetTemperature(3000);
+	for (i = 0; i < 3; i++) {
+		CHugHostSetVdd(vdd[i]);
+		rc = CHugHostCommandSimple(CH_CMD_GET_TEMPERATURE, NULL, 0, reply);
+		memcpy (&temperature, &reply[CH_BUFFER_OUTPUT_DATA], 2);
+		printf("%.2fC with VDD at %umV\n", temperature / 100.f, vdd[i]);
+		if (rc != CH_ERROR_NONE ||
+		    temperature < 3000 - 200 || temperature > 3000 + 200) {
+			fprintf(stderr, "temperature should be 30.00C\n");
+			return false;
+		}
+	}
+	CHugHostSetVdd(5000);
+	return true;
+}
+
+/**
+ * CHugHostTestFlashSuccess:
+ **/
+static bool
+CHugHostTestFlashSuccess(void)
+{
+	uint8_t reply[CH_USB_HID_EP_SIZE];
+	uint8_t value = 0x01;
+	int rc;
+
+	rc = CHugHostCommandSimple(CH_CMD_SET_FLASH_SUCCESS, &value, 1, reply);
+	if (rc != CH_ERROR_NONE ||
+	    (CHugHostFlashGetWord(CH_EEPROM_ADDR_FLASH_SUCCESS / 2) & 0xff) != 0x01) {
+		fprintf(stderr, "failed to set flash success: %i\n", rc);
+		return false;
+	}
+	printf("flash success written\n");
+	return true;
+}
+
+/**
+ * CHugHostTestFlashErase:
+ *
+ * Checks erasing the fault log row leaves the rows after it alone.
+ **/
+static bool
+CHugHostTestFlashErase(void)
+{
+	const uint16_t rows[] = { CH_EEPROM_ADDR_FAULT_LOG,
+				  CH_EEPROM_ADDR_FLASH_SUCCESS,
+				  CH_EEPROM_ADDR_DARK_OFFSETS };
+	uint16_t word;
+	uint8_t i;
+
+	for (i = 0; i < 3; i++)
+		CHugHostFlashSetWord(rows[i] / 2, 0x1234 + i);
+	CHugFlashErase(CH_EEPROM_ADDR_FAULT_LOG, CH_FLASH_ERASE_BLOCK_SIZE);
+	for (i = 0; i < 3; i++) {
+		word = CHugHostFlashGetWord(rows[i] / 2);
+		printf("0x%04x holds 0x%04x after erasing the fault log\n",
+		       rows[i], word);
+		if (word != (i == 0 ? CH_HOST_FLASH_ERASED : 0x1234 + i)) {
+			fprintf(stderr, "wrong rows erased\n");
+			return false;
+		}
+	}
+	return true;
+}
+
+/* the settings kept in the rows at the end of the flash */
+typedef struct {
+	uint8_t		 fault_log[CH_FAULT_LOG_SIZE];
+	uint8_t		 flash_success;
+	uint8_t		 dark_offsets[8];
+	uint8_t		 temp_coefficients[CH_TEMP_COEFFICIENTS_SIZE];
+} ChHostConfig;
+
+/**
+ * CHugHostGetConfig:
+ **/
+static void
+CHugHostGetConfig(ChHostConfig *config)
+{
+	uint8_t reply[CH_USB_HID_EP_SIZE];
+	uint8_t value = CH_FREQ_SCALE_100;
+
+	CHugHostCommandSimple(CH_CMD_GET_FAULT_LOG, NULL, 0, reply);
+	memcpy (config->fault_log, &reply[CH_BUFFER_OUTPUT_DATA],
+		sizeof(config->fault_log));
+	config->flash_success =
+		CHugHostFlashGetWord(CH_EEPROM_ADDR_FLASH_SUCCESS / 2) & 0xff;
+	CHugHostCommandSimple(CH_CMD_GET_DARK_OFFSETS, &value, 1, reply);
+	memcpy (config->dark_offsets, &reply[CH_BUFFER_OUTPUT_DATA],
+		sizeof(config->dark_offsets));
+	CHugHostCommandSimple(CH_CMD_GET_TEMP_COEFFICIENTS, NULL, 0, reply);
+	memcpy (config->temp_coefficients, &reply[CH_BUFFER_OUTPUT_DATA],
+		sizeof(config->temp_coefficients));
+}
+
+/**
+ * CHugHostTestConfigRows:
+ *
+ * Stores each of the settings at the end of the flash in turn, and
+ * checks that only the one being stored changes each time.
+ **/
+static bool
+CHugHostTestConfigRows(void)
+{
+	const uint16_t fault_log[5] = { CH_ERROR_WATCHDOG, 0, 0, 0, 1 };
+	const int16_t coefficients[5] = { 100, 200, 300, 400, 2000 };
+	ChHostConfig expected;
+	ChHostConfig config;
+	uint8_t reply[CH_USB_HID_EP_SIZE];
+	uint8_t value;
+	uint8_t i;
+
+	for (i = 0; i < CH_COLOR_SELECT_GREEN + 1; i++)
+		CHugHostSetSensorFrequency(i, 100);
+	CHugHostGetConfig(&expected);
+	for (i = 0; i < 4; i++) {
+		switch (i) {
+		case 0:
+			/* as CHugFatalError() does */
+			CHugFlashErase(CH_EEPROM_ADDR_FAULT_LOG,
+				       CH_FLASH_ERASE_BLOCK_SIZE);
+			CHugFlashWrite(CH_EEPROM_ADDR_FAULT_LOG,
+				       sizeof(fault_log),
+				       (const uint8_t *) fault_log);
+			memcpy (expected.fault_log, fault_log,
+				sizeof(expected.fault_log));
+			break;
+		case 1:
+			value = expected.flash_success == 0x01 ? 0xff : 0x01;
+			CHugHostCommandSimple(CH_CMD_SET_FLASH_SUCCESS,
+					      &value, 1, reply);
+			expected.flash_success = value;
+			break;
+		case 2:
+			CHugHostCommandSimple(CH_CMD_TAKE_DARK_CALIBRATION,
+					      NULL, 0, reply);
+			memcpy (expected.dark_offsets,
+				&reply[CH_BUFFER_OUTPUT_DATA],
+				sizeof(expected.dark_offsets));
+			break;
+		case 3:
+			CHugHostCommandSimple(CH_CMD_SET_TEMP_COEFFICIENTS,
+					      coefficients,
+					      sizeof(coefficients), reply);
+			memcpy (expected.temp_coefficients, coefficients,
+				sizeof(expected.temp_coefficients));
+			break;
+		}
+		CHugHostGetConfig(&config);
+		if (memcmp (&config, &expected, sizeof(config)) != 0) {
+			fprintf(stderr, "storing setting %u changed another\n", i);
+			return false;
+		}
+	}
+	printf("each setting in flash kept while storing the others\n");
+	return true;
+}
+
+typedef struct {
+	const char	*name;
+	bool		(*func)(void);
+} ChHostTest;
+
+/* run in order on the same device, so later tests see the settings
+ * earlier ones leave behind */
+static const ChHostTest host_tests[] = {
+	{ "version",		CHugHostTestVersion },
+	{ "feature-report",	CHugHostTestFeatureReport },
+	{ "ping",		CHugHostTestPing },
+	{ "stats",		CHugHostTestStats },
+	{ "readings",		CHugHostTestReadings },
+	{ "power-timeout",	CHugHostTestPowerTimeout },
+	{ "suspend",		CHugHostTestSuspend },
+	{ "remote-wakeup",	CHugHostTestRemoteWakeup },
+	{ "program",		CHugHostTestProgram },
+	{ "program-slow",	CHugHostTestProgramSlow },
+	{ "armed-reading",	CHugHostTestArmedReading },
+	{ "self-test",		CHugHostTestSelfTest },
+	{ "self-test-power",	CHugHostTestSelfTestPower },
+	{ "dark-offsets",	CHugHostTestDarkOffsets },
+	{ "temp-compensation",	CHugHostTestTempCompensation },
+	{ "temp-supply",	CHugHostTestTempSupply },
+	{ "flash-erase",	CHugHostTestFlashErase },
+	{ "config-rows",	CHugHostTestConfigRows },
+	{ "flash-success",	CHugHostTestFlashSuccess },
+	{ NULL,			NULL }
+};
+
+/**
+ * main:
+ **/
+int
+main(int argc, char *argv[])
+{
+	const ChHostTest *test;
+
+	if (argc > 1 && strcmp(argv[1], "bench") == 0)
+		return CHugBench(argc > 2 ? argv[2] : NULL,
+				 argc > 3 && strcmp(argv[3], "--update") == 0);
+	if (argc > 1)
+		host_integral_time = strtoul(argv[1], NULL, 0);
+
+	CHugHostStart();
+	for (test = host_tests; test->name != NULL; test++) {
+		if (!test->func()) {
+			fprintf(stderr, "%s: FAILED\n", test->name);
+			return EXIT_FAILURE;
+		}
+	}
+	return EXIT_SUCCESS;
+}
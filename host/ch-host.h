@@ -0,0 +1,43 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __CH_HOST_H
+#define __CH_HOST_H
+
+#include <stdint.h>
+
+/* what a main loop iteration costs when there is nothing to do */
+#define	CH_HOST_CYCLES_PER_LOOP			200
+
+/* give up waiting for the firmware after this many iterations */
+#define	CH_HOST_MAX_LOOPS			100000
+
+void		 CHugHostStart		(void);
+void		 CHugHostRunLoop	(void);
+int		 CHugHostCommand	(const uint8_t	*req,
+					 uint8_t	*reply);
+int		 CHugHostCommandSimple	(uint8_t	 cmd,
+					 const void	*data,
+					 uint8_t	 len,
+					 uint8_t	*reply);
+uint32_t	 CHugHostGetProcessCycles (void);
+
+#endif /* __CH_HOST_H */
@@ -0,0 +1,430 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "ColorHug.h"
+
+#include <string.h>
+#include <USB/usb.h>
+#include <USB/usb_function_hid.h>
+
+#include "ch-usb-host.h"
+
+/* a buffer descriptor, which is owned by the host when busy */
+typedef struct {
+	BYTE		*data;
+	WORD		 len;
+	WORD		 actual;
+	bool		 busy;
+} ChHostBd;
+
+#define	CH_HOST_BD_OUT		0
+#define	CH_HOST_BD_IN		1
+
+/* each endpoint has even and odd descriptors in each direction, which
+ * are armed and then completed in turn */
+static ChHostBd		host_bd[USB_MAX_EP_NUMBER + 1][2][2];
+static uint8_t		host_bd_armed[USB_MAX_EP_NUMBER + 1][2];
+static uint8_t		host_bd_done[USB_MAX_EP_NUMBER + 1][2];
+
+/* the control endpoint data stage */
+static const BYTE	*host_ep0_src = NULL;
+static WORD		 host_ep0_src_len = 0;
+static BYTE		*host_ep0_dest = NULL;
+static WORD		 host_ep0_dest_len = 0;
+static void		(*host_ep0_func)(void) = NULL;
+static bool		 host_ep0_deferred = false;
+static bool		 host_ep0_status_deferred = false;
+
+static uint16_t		 host_frame = 0;
+
+volatile BYTE		 USBDeviceState = DETACHED_STATE;
+volatile BYTE		 USBActiveConfiguration = 0;
+volatile BOOL		 RemoteWakeup = FALSE;
+volatile BOOL		 USBBusIsSuspended = FALSE;
+volatile CTRL_TRF_SETUP	 SetupPkt;
+
+/**
+ * USBDeviceInit:
+ **/
+void
+USBDeviceInit(void)
+{
+	memset (host_bd, 0, sizeof(host_bd));
+	memset (host_bd_armed, 0, sizeof(host_bd_armed));
+	memset (host_bd_done, 0, sizeof(host_bd_done));
+	USBDeviceState = DETACHED_STATE;
+	USBActiveConfiguration = 0;
+	UCONbits.SUSPND = 0;
+#if defined(USB_INTERRUPT)
+	PIE2bits.USBIE = 1;
+#endif
+}
+
+/**
+ * USBDeviceAttach:
+ **/
+void
+USBDeviceAttach(void)
+{
+	USBDeviceState = POWERED_STATE;
+	UCONbits.USBEN = 1;
+}
+
+/**
+ * USBDeviceTasks:
+ *
+ * Sends EVENT_SOF when the simulated frame number has changed.
+ **/
+void
+USBDeviceTasks(void)
+{
+	uint16_t frame = ((uint16_t) UFRMH << 8) | UFRML;
+
+	PIR2bits.USBIF = 0;
+	if (USBDeviceState < DEFAULT_STATE || UCONbits.SUSPND)
+		return;
+	if (frame == host_frame)
+		return;
+	host_frame = frame;
+	USER_USB_CALLBACK_EVENT_HANDLER(EVENT_SOF, NULL, 1);
+}
+
+/**
+ * USBEnableEndpoint:
+ **/
+void
+USBEnableEndpoint(BYTE ep, BYTE options)
+{
+	memset (host_bd[ep], 0, sizeof(host_bd[ep]));
+	host_bd_armed[ep][CH_HOST_BD_OUT] = 0;
+	host_bd_armed[ep][CH_HOST_BD_IN] = 0;
+	host_bd_done[ep][CH_HOST_BD_OUT] = 0;
+	host_bd_done[ep][CH_HOST_BD_IN] = 0;
+}
+
+/**
+ * CHugHostBdArm:
+ **/
+static USB_HANDLE
+CHugHostBdArm(BYTE ep, uint8_t dir, BYTE *data, WORD len)
+{
+	ChHostBd *bd;
+
+	ep &= USB_MAX_EP_NUMBER;
+	bd = &host_bd[ep][dir][host_bd_armed[ep][dir]];
+	host_bd_armed[ep][dir] ^= 1;
+	bd->data = data;
+	bd->len = len;
+	bd->actual = len;
+	bd->busy = true;
+	return (USB_HANDLE) bd;
+}
+
+/**
+ * USBTxOnePacket:
+ **/
+USB_HANDLE
+USBTxOnePacket(BYTE ep, BYTE *data, WORD len)
+{
+	return CHugHostBdArm(ep, CH_HOST_BD_IN, data, len);
+}
+
+/**
+ * USBRxOnePacket:
+ **/
+USB_HANDLE
+USBRxOnePacket(BYTE ep, BYTE *data, WORD len)
+{
+	return CHugHostBdArm(ep, CH_HOST_BD_OUT, data, len);
+}
+
+/**
+ * USBHandleBusy:
+ **/
+BOOL
+USBHandleBusy(USB_HANDLE handle)
+{
+	if (handle == NULL)
+		return FALSE;
+	return ((ChHostBd *) handle)->busy;
+}
+
+/**
+ * USBHandleGetLength:
+ **/
+WORD
+USBHandleGetLength(USB_HANDLE handle)
+{
+	return ((ChHostBd *) handle)->actual;
+}
+
+/**
+ * USBEP0SendRAMPtr:
+ **/
+void
+USBEP0SendRAMPtr(BYTE *src, WORD size, BYTE options)
+{
+	host_ep0_src = src;
+	host_ep0_src_len = size;
+}
+
+/**
+ * USBEP0SendROMPtr:
+ **/
+void
+USBEP0SendROMPtr(ROM BYTE *src, WORD size, BYTE options)
+{
+	host_ep0_src = src;
+	host_ep0_src_len = size;
+}
+
+/**
+ * USBEP0Receive:
+ **/
+void
+USBEP0Receive(BYTE *dest, WORD size, void (*func)(void))
+{
+	host_ep0_dest = dest;
+	host_ep0_dest_len = size;
+	host_ep0_func = func;
+}
+
+/**
+ * USBDeferINDataStage:
+ **/
+void
+USBDeferINDataStage(void)
+{
+	host_ep0_deferred = true;
+}
+
+/**
+ * USBDeferOUTDataStage:
+ **/
+void
+USBDeferOUTDataStage(void)
+{
+	host_ep0_deferred = true;
+}
+
+/**
+ * USBCtrlEPAllowDataStage:
+ **/
+void
+USBCtrlEPAllowDataStage(void)
+{
+	host_ep0_deferred = false;
+}
+
+/**
+ * USBDeferStatusStage:
+ **/
+void
+USBDeferStatusStage(void)
+{
+	host_ep0_status_deferred = true;
+}
+
+/**
+ * USBCtrlEPAllowStatusStage:
+ **/
+void
+USBCtrlEPAllowStatusStage(void)
+{
+	host_ep0_status_deferred = false;
+}
+
+/**
+ * USBMaskInterrupts:
+ **/
+void
+USBMaskInterrupts(void)
+{
+}
+
+/**
+ * USBUnmaskInterrupts:
+ **/
+void
+USBUnmaskInterrupts(void)
+{
+}
+
+/**
+ * USBCheckHIDRequest:
+ *
+ * Only the requests the firmware handles itself are passed on.
+ **/
+void
+USBCheckHIDRequest(void)
+{
+	if (SetupPkt.Recipient != USB_SETUP_RECIPIENT_INTERFACE_BITFIELD)
+		return;
+	if (SetupPkt.RequestType != USB_SETUP_TYPE_CLASS_BITFIELD)
+		return;
+#if defined(USER_GET_REPORT_HANDLER)
+	if (SetupPkt.bRequest == GET_REPORT)
+		USER_GET_REPORT_HANDLER();
+#endif
+#if defined(USER_SET_REPORT_HANDLER)
+	if (SetupPkt.bRequest == SET_REPORT)
+		USER_SET_REPORT_HANDLER();
+#endif
+}
+
+/**
+ * CHugHostUsbConfigure:
+ *
+ * Acts as if the host has set the configuration.
+ **/
+void
+CHugHostUsbConfigure(void)
+{
+	USBDeviceState = CONFIGURED_STATE;
+	USBActiveConfiguration = CH_USB_CONFIG;
+	USER_USB_CALLBACK_EVENT_HANDLER(EVENT_CONFIGURED, NULL, 1);
+}
+
+/**
+ * CHugHostUsbSuspend:
+ **/
+void
+CHugHostUsbSuspend(bool suspend)
+{
+	UCONbits.SUSPND = suspend;
+	USBBusIsSuspended = suspend;
+	USER_USB_CALLBACK_EVENT_HANDLER(suspend ? EVENT_SUSPEND : EVENT_RESUME,
+					NULL, 0);
+}
+
+/**
+ * CHugHostUsbWrite:
+ * @ep: the endpoint number
+ * @data: the packet to send to the device
+ * @len: the size of @data
+ *
+ * Returns: %false if the device NAKed the packet
+ **/
+bool
+CHugHostUsbWrite(uint8_t ep, const uint8_t *data, uint16_t len)
+{
+	ChHostBd *bd = &host_bd[ep][CH_HOST_BD_OUT][host_bd_done[ep][CH_HOST_BD_OUT]];
+
+	if (!bd->busy)
+		return false;
+	if (len > bd->len)
+		len = bd->len;
+	memcpy (bd->data, data, len);
+	bd->actual = len;
+	bd->busy = false;
+	host_bd_done[ep][CH_HOST_BD_OUT] ^= 1;
+	return true;
+}
+
+/**
+ * CHugHostUsbRead:
+ * @ep: the endpoint number
+ * @data: the buffer for the packet from the device
+ * @len: the size of @data
+ *
+ * Returns: the packet length, or -1 if the device NAKed the request
+ **/
+int
+CHugHostUsbRead(uint8_t ep, uint8_t *data, uint16_t len)
+{
+	ChHostBd *bd = &host_bd[ep][CH_HOST_BD_IN][host_bd_done[ep][CH_HOST_BD_IN]];
+
+	if (!bd->busy)
+		return -1;
+	if (len > bd->actual)
+		len = bd->actual;
+	memcpy (data, bd->data, len);
+	bd->busy = false;
+	host_bd_done[ep][CH_HOST_BD_IN] ^= 1;
+	return len;
+}
+
+/**
+ * CHugHostUsbControl:
+ * @setup: the setup packet
+ * @data: the data stage to send or receive
+ * @len: the size of @data
+ *
+ * Returns: the length of the data stage, -1 if it was stalled, or -2 if
+ * the device has deferred it and CHugHostUsbControlIn() should be used
+ * once the firmware has been run
+ **/
+int
+CHugHostUsbControl(const CTRL_TRF_SETUP *setup, uint8_t *data, uint16_t len)
+{
+	memcpy ((void *) &SetupPkt, setup, sizeof(CTRL_TRF_SETUP));
+	host_ep0_src = NULL;
+	host_ep0_dest = NULL;
+	host_ep0_func = NULL;
+	host_ep0_deferred = false;
+	host_ep0_status_deferred = false;
+	USER_USB_CALLBACK_EVENT_HANDLER(EVENT_EP0_REQUEST, NULL, 0);
+
+	/* data stage from the host */
+	if (setup->DataDir == USB_SETUP_HOST_TO_DEVICE_BITFIELD) {
+		if (host_ep0_dest == NULL)
+			return -1;
+		if (len > host_ep0_dest_len)
+			len = host_ep0_dest_len;
+		memcpy (host_ep0_dest, data, len);
+		if (host_ep0_func != NULL)
+			host_ep0_func();
+		return len;
+	}
+	return CHugHostUsbControlIn(data, len);
+}
+
+/**
+ * CHugHostUsbControlIn:
+ *
+ * Returns: the length of the data stage, -1 if it was stalled, or -2 if
+ * it is still deferred
+ **/
+int
+CHugHostUsbControlIn(uint8_t *data, uint16_t len)
+{
+	if (host_ep0_deferred)
+		return -2;
+	if (host_ep0_src == NULL)
+		return -1;
+	if (len > host_ep0_src_len)
+		len = host_ep0_src_len;
+	memcpy (data, host_ep0_src, len);
+	host_ep0_src = NULL;
+	return len;
+}
+
+/**
+ * CHugHostUsbControlStatusDone:
+ *
+ * Returns: %false if the device is still holding off the status stage
+ * of the last control transfer
+ **/
+bool
+CHugHostUsbControlStatusDone(void)
+{
+	return !host_ep0_status_deferred;
+}
@@ -0,0 +1,45 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __CH_USB_HOST_H
+#define __CH_USB_HOST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <USB/usb.h>
+
+void		 CHugHostUsbConfigure	(void);
+void		 CHugHostUsbSuspend	(bool		 suspend);
+bool		 CHugHostUsbWrite	(uint8_t	 ep,
+					 const uint8_t	*data,
+					 uint16_t	 len);
+int		 CHugHostUsbRead	(uint8_t	 ep,
+					 uint8_t	*data,
+					 uint16_t	 len);
+int		 CHugHostUsbControl	(const CTRL_TRF_SETUP *setup,
+					 uint8_t	*data,
+					 uint16_t	 len);
+int		 CHugHostUsbControlIn	(uint8_t	*data,
+					 uint16_t	 len);
+bool		 CHugHostUsbControlStatusDone (void);
+
+#endif /* __CH_USB_HOST_H */
@@ -0,0 +1,111 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2015 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Stands in for the XC8 device header when building for the host.
+ *
+ * Each register is a plain variable, with the named bits in a separate
+ * variable, so writing PORTCbits.RC5 does not change PORTC. The firmware
+ * only uses one or the other for each register, and anything that has
+ * to react to the hardware goes through ch-hal.h instead.
+ */
+
+#ifndef __CH_HOST_XC_H
+#define __CH_HOST_XC_H
+
+#include <stdint.h>
+
+/* XC8 does not need a declaration for memcpy() and memset() */
+#include <string.h>
+
+#include "ch-hal-host.h"
+
+#define	interrupt
+#define	__CONFIG(x)
+#define	CLRWDT()		do { } while (0)
+#define	NOP()			do { } while (0)
+#define	RESET()			CHugHostReset()
+#define	SLEEP()			CHugHostSleep()
+#define	_delay(x)		CHugHostAdvance(x)
+#define	asm(x)			do { } while (0)
+#define	di()			do { INTCONbits.GIE = 0; } while (0)
+#define	ei()			do { INTCONbits.GIE = 1; } while (0)
+
+typedef struct {
+	/* PORTA, PORTC, TRISA, TRISC */
+	unsigned	 RA0:1, RA1:1, RA2:1, RA3:1, RA4:1, RA5:1, RA6:1, RA7:1;
+	unsigned	 RC0:1, RC1:1, RC2:1, RC3:1, RC4:1, RC5:1, RC6:1, RC7:1;
+	unsigned	 TRISA4:1, TRISA5:1, TRISC2:1, TRISC3:1, TRISC4:1, TRISC5:1;
+	/* PMCON1 */
+	unsigned	 RD:1, WR:1, WREN:1, WRERR:1, FREE:1, LWLO:1, CFGS:1;
+	/* UCON, UCFG */
+	unsigned	 USBEN:1, SUSPND:1, RESUME:1, PPBRST:1, SE0:1, PKTDIS:1;
+	unsigned	 UPUEN:1, FSEN:1, PPB:2;
+	/* OSCCON, OSCSTAT */
+	unsigned	 SCS:2, IRCF:4, SPLLEN:1, SPLLMULT:1, PLLRDY:1, HFIOFR:1;
+	/* PCON, WDTCON */
+	unsigned	 STKOVF:1, STKUNF:1, nRWDT:1, nRMCLR:1, nRI:1, nPOR:1;
+	unsigned	 nBOR:1, SWDTEN:1, WDTPS:5;
+	/* PIR1, PIE1, PIR2, PIE2, INTCON */
+	unsigned	 TMR1IF:1, TMR1IE:1, TMR2IF:1, TMR2IE:1, ADIF:1, ADIE:1;
+	unsigned	 USBIF:1, USBIE:1, ACTIF:1, ACTIE:1;
+	unsigned	 GIE:1, PEIE:1, TMR0IE:1, INTE:1, IOCIE:1, TMR0IF:1;
+	unsigned	 INTF:1, IOCIF:1;
+	/* T1CON, T2CON */
+	unsigned	 TMR1ON:1, nT1SYNC:1, T1OSCEN:1, T1CKPS:2, TMR1CS:2;
+	unsigned	 T2CKPS:2, TMR2ON:1, T2OUTPS:4;
+	/* IOCAP, IOCAN, IOCAF */
+	unsigned	 IOCAP4:1, IOCAN4:1, IOCAF4:1;
+	/* FVRCON, ADCON0, ADCON1 */
+	unsigned	 FVREN:1, FVRRDY:1, TSEN:1, TSRNG:1, ADFVR:2;
+	unsigned	 ADON:1, GO_nDONE:1, CHS:5, ADPREF:2, ADCS:3, ADFM:1;
+	/* ACTCON */
+	unsigned	 ACTSRC:1, ACTUD:1, ACTEN:1;
+	/* UIR, UIE */
+	unsigned	 URSTIF:1, UERRIF:1, ACTVIF:1, TRNIF:1, IDLEIF:1;
+	unsigned	 STALLIF:1, SOFIF:1, ACTVIE:1, IDLEIE:1;
+} ChHostBits;
+
+#define	CH_HOST_SFR(name)						\
+	extern volatile uint8_t name;					\
+	extern volatile ChHostBits name##bits;
+
+CH_HOST_SFR(PORTA)	CH_HOST_SFR(PORTC)	CH_HOST_SFR(LATA)
+CH_HOST_SFR(LATC)	CH_HOST_SFR(TRISA)	CH_HOST_SFR(TRISC)
+CH_HOST_SFR(ANSELA)	CH_HOST_SFR(ANSELC)	CH_HOST_SFR(WPUA)
+CH_HOST_SFR(PMCON1)	CH_HOST_SFR(PMCON2)	CH_HOST_SFR(PMDATL)
+CH_HOST_SFR(PMDATH)	CH_HOST_SFR(PMADRL)	CH_HOST_SFR(PMADRH)
+CH_HOST_SFR(UCON)	CH_HOST_SFR(UCFG)	CH_HOST_SFR(UIR)
+CH_HOST_SFR(UIE)	CH_HOST_SFR(UFRMH)	CH_HOST_SFR(UFRML)
+CH_HOST_SFR(OSCCON)	CH_HOST_SFR(OSCSTAT)	CH_HOST_SFR(ACTCON)
+CH_HOST_SFR(PCON)	CH_HOST_SFR(WDTCON)	CH_HOST_SFR(STATUS)
+CH_HOST_SFR(STKPTR)	CH_HOST_SFR(TOSL)	CH_HOST_SFR(TOSH)
+CH_HOST_SFR(INTCON)	CH_HOST_SFR(PIR1)	CH_HOST_SFR(PIE1)
+CH_HOST_SFR(PIR2)	CH_HOST_SFR(PIE2)	CH_HOST_SFR(T1CON)
+CH_HOST_SFR(TMR1L)	CH_HOST_SFR(TMR1H)	CH_HOST_SFR(T2CON)
+CH_HOST_SFR(TMR2)	CH_HOST_SFR(PR2)	CH_HOST_SFR(IOCAP)
+CH_HOST_SFR(IOCAN)	CH_HOST_SFR(IOCAF)	CH_HOST_SFR(FVRCON)
+CH_HOST_SFR(ADCON0)	CH_HOST_SFR(ADCON1)	CH_HOST_SFR(ADCON2)
+CH_HOST_SFR(ADRESL)	CH_HOST_SFR(ADRESH)
+
+extern volatile uint16_t PMADR;
+
+#endif /* __CH_HOST_XC_H */
@@ -22,12 +22,17 @@
 #ifndef __USB_CONFIG_H
 #define __USB_CONFIG_H
 
-/* we only do small amounts of data */
+/* we only do small amounts of data, and feature reports are split
+ * into several packets by the stack */
 #define USB_EP0_BUFF_SIZE		8
 
 /* no alternative setting */
-#define USB_MAX_NUM_INT			1
-#define USB_MAX_EP_NUMBER		1
+#ifdef COLORHUG_BOOTLOADER
+#define USB_MAX_NUM_INT			2
+#else
+#define USB_MAX_NUM_INT			3
+#endif
+#define USB_MAX_EP_NUMBER		3
 
 //Device descriptor - if these two definitions are not defined then
 //  a ROM USB_DEVICE_DESCRIPTOR variable by the exact name of device_dsc
@@ -42,8 +47,14 @@
 
 #define USB_PING_PONG_MODE USB_PING_PONG__FULL_PING_PONG
 
-/* we want to poll */
+/* the firmware can service the bus from the ISR so that long readings do
+ * not starve the stack, but the bootloader has to poll as the interrupt
+ * vector belongs to the firmware */
+#if defined(COLORHUG_USB_INTERRUPT) && !defined(COLORHUG_BOOTLOADER)
+#define USB_INTERRUPT
+#else
 #define USB_POLLING
+#endif
 
 /* Parameter definitions are defined in usb_device.h */
 #define USB_PULLUP_OPTION		USB_PULLUP_ENABLE
@@ -62,6 +73,24 @@
 #define HID_INT_OUT_EP_SIZE		3
 #define HID_INT_IN_EP_SIZE		3
 #define HID_NUM_OF_DSC			1
-#define HID_RPT01_SIZE			29
+#define HID_RPT01_SIZE			35
+
+/* configuration commands can also be run using feature reports */
+#ifndef COLORHUG_BOOTLOADER
+#define USER_GET_REPORT_HANDLER		CHugGetReportHandler
+#define USER_SET_REPORT_HANDLER		CHugSetReportHandler
+void CHugGetReportHandler(void);
+void CHugSetReportHandler(void);
+#endif
+
+/* vendor interface, bulk IN and OUT in bootloader mode, bulk IN only
+ * in firmware mode */
+#define VENDOR_INTF_ID			0x01
+#define VENDOR_EP			0x03
+
+/* HID interface only used for streaming samples to the host */
+#define HID_STREAM_INTF_ID		0x02
+#define HID_STREAM_EP			0x02
+#define HID_RPT02_SIZE			23
 
 #endif
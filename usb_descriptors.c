@@ -60,24 +60,55 @@ ROM BYTE configDescriptor1[]={
 	/* Configuration Descriptor */
 	0x09,			/* Size of this descriptor in bytes */
 	USB_DESCRIPTOR_CONFIGURATION,	/* CONFIGURATION descriptor type */
-	0x32,0x00,			/* Total length of data */
-	1,				/* Number of interfaces */
+#ifdef COLORHUG_BOOTLOADER
+	0x40,0x00,			/* Total length of data */
+	2,				/* Number of interfaces */
+#else
+	0x52,0x00,			/* Total length of data */
+	3,				/* Number of interfaces */
+#endif
 	1,				/* Index value of this configuration */
 	0,				/* Configuration string index */
+#ifdef COLORHUG_BOOTLOADER
 	_DEFAULT | _SELF,		/* Attributes (this device is self-powered, but has no remote wakeup), see usb_device.h */
-	150,				/* Max power consumption (2X mA)
+#else
+	_DEFAULT | _SELF | _RWU,	/* Attributes (this device is self-powered, and has remote wakeup), see usb_device.h */
+#endif
+	150,				/* Max power consumption (2X mA) */
 
 	/* Interface Descriptor */
 	0x09,				/* Size of this descriptor in bytes */
 	USB_DESCRIPTOR_INTERFACE,	/* INTERFACE descriptor type */
-	1,				/* Interface Number */
+	VENDOR_INTF_ID,			/* Interface Number */
 	0,				/* Alternate Setting Number */
-	0,				/* Number of endpoints in this intf */
+#ifdef COLORHUG_BOOTLOADER
+	2,				/* Number of endpoints in this intf */
+#else
+	1,				/* Number of endpoints in this intf */
+#endif
 	0xff,				/* Class code */
 	'F',				/* Subclass code */
 	'W',				/* Protocol code */
 	0x03,				/* Interface string index */
 
+	/* Endpoint Descriptor */
+	0x07,
+	USB_DESCRIPTOR_ENDPOINT,	/* Endpoint Descriptor */
+	VENDOR_EP | _EP_IN,		/* EndpointAddress */
+	_BULK,				/* Attributes */
+	CH_USB_BULK_EP_SIZE,0x00,	/* size (with extra byte) */
+	0x00,				/* polling interval */
+#ifdef COLORHUG_BOOTLOADER
+
+	/* Endpoint Descriptor */
+	0x07,
+	USB_DESCRIPTOR_ENDPOINT,	/* Endpoint Descriptor */
+	VENDOR_EP | _EP_OUT,		/* EndpointAddress */
+	_BULK,				/* Attributes */
+	CH_USB_BULK_EP_SIZE,0x00,	/* size (with extra byte) */
+	0x00,				/* polling interval */
+#endif
+
 	/* Interface Descriptor */
 	0x09,   			/* Size of this descriptor in bytes */
 	USB_DESCRIPTOR_INTERFACE,	/* INTERFACE descriptor type */
@@ -112,7 +143,37 @@ ROM BYTE configDescriptor1[]={
 	HID_EP | _EP_OUT,		/* EndpointAddress */
 	_INTERRUPT,			/* Attributes */
 	0x40,0x00,			/* size (with extra byte) */
+	0x01,				/* polling interval */
+#ifndef COLORHUG_BOOTLOADER
+
+	/* Interface Descriptor */
+	0x09,   			/* Size of this descriptor in bytes */
+	USB_DESCRIPTOR_INTERFACE,	/* INTERFACE descriptor type */
+	HID_STREAM_INTF_ID,		/* Interface Number */
+	0,				/* Alternate Setting Number */
+	1,				/* Number of endpoints in this intf */
+	HID_INTF,			/* Class code */
+	0,				/* Subclass code */
+	0,				/* Protocol code */
+	0,				/* Interface string index */
+
+	/* HID Class-Specific Descriptor */
+	0x09,				/* Size of this descriptor in bytes */
+	DSC_HID,			/* HID descriptor type */
+	0x11,0x01,			/* HID Spec Release Number (BCD format) */
+	0x00,				/* Country Code (0x00 for Not supported) */
+	HID_NUM_OF_DSC,			/* Number of class descriptors, see usbcfg.h */
+	DSC_RPT,			/* Report descriptor type */
+	HID_RPT02_SIZE,0x00,		/* Size of the report descriptor (with extra byte) */
+
+	/* Endpoint Descriptor */
+	0x07,
+	USB_DESCRIPTOR_ENDPOINT,	/* Endpoint Descriptor */
+	HID_STREAM_EP | _EP_IN,		/* EndpointAddress */
+	_INTERRUPT,			/* Attributes */
+	CH_USB_HID_STREAM_EP_SIZE,0x00,	/* size (with extra byte) */
 	0x01				/* polling interval */
+#endif
 };
 
 /* Language code string descriptor */
@@ -197,8 +258,32 @@ ROM struct
 	0x19, 0x01,			/* Usage Minimum */
 	0x29, 0x40,			/* Usage Maximum - 64 output usages total (0x01 to 0x40) */
 	0x91, 0x02,			/* Output (Data, Array, Abs): Instantiates output packet fields.  Uses same report size and count as "Input" fields, since nothing new/different was specified to the parser since the "Input" item. */
+	0x19, 0x01,			/* Usage Minimum */
+	0x29, 0x40,			/* Usage Maximum - 64 feature usages total (0x01 to 0x40) */
+	0xB1, 0x02,			/* Feature (Data, Array, Abs): Instantiates feature report fields, again of the same size and count. */
+	0xC0}				/* End Collection */
+};
+
+#ifndef COLORHUG_BOOTLOADER
+/* HID descriptor for the stream interface, which only has input reports */
+ROM struct
+{
+	BYTE report[HID_RPT02_SIZE];
+} hid_rpt02 = {
+{
+	0x06, 0x00, 0xFF,		/* Usage Page = 0xFF00 (Vendor Defined Page 1) */
+	0x09, 0x02,			/* Usage (Vendor Usage 2) */
+	0xA1, 0x01,			/* Collection (Application) */
+	0x19, 0x01,			/* Usage Minimum */
+	0x29, 0x10,			/* Usage Maximum -- 16 input usages total (0x01 to 0x10) */
+	0x15, 0x00,			/* Logical Minimum (Vendor Usage = 0) */
+	0x26, 0xFF, 0x00,		/* Logical Maximum (Vendor Usage = 255) */
+	0x75, 0x08,			/* Report Size: 8-bit field size */
+	0x95, 0x10,			/* Report Count: Make sixteen 8-bit fields */
+	0x81, 0x02,			/* Input (Data, Array, Abs) */
 	0xC0}				/* End Collection */
 };
+#endif
 
 /* only one configuration descriptor */
 ROM BYTE *ROM USB_CD_Ptr[]=